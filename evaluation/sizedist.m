@@ -58,6 +58,8 @@ endfunction
 
 # create parser with default options
 parser = luna_default_parser();
+# write the size distribution as a table for the empirical generator
+parser = parser.addSwitch("table");
 # parse command line options
 parser = parser.parse(opts{:});
 
@@ -83,5 +85,18 @@ endfor
 
 plot_size_dist(sizes{:});
 
+if parser.Results.table
+  # one line per packet size with its number of occurrences, in the
+  # format the empirical generator reads
+  [values, ~, index] = unique(vertcat(sizes{:}));
+  counts = accumarray(index(:), 1);
+  tablefile = strcat(parser.Results.out, "-size.table");
+  f = fopen(tablefile, "w");
+  fprintf(f, "# packet size [byte]\tcount\n");
+  fprintf(f, "%d\t%d\n", [values(:) counts(:)]');
+  fclose(f);
+  printf("Wrote size table to %s\n", tablefile);
+endif
+
 print_format(strcat(parser.Results.out, "-size.", parser.Results.format),
 	     parser.Results.format);
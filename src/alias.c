@@ -0,0 +1,102 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "alias.h"
+#include "luna.h"
+
+
+
+int alias_table_init(struct alias_table *table, const double *const weights,
+		     const uint32_t n)
+{
+	if (n == 0)
+		return -1;
+	double sum = 0;
+	for (uint32_t i = 0; i < n; i++)
+	{
+		if (!(weights[i] >= 0))
+			return -1;
+		sum += weights[i];
+	}
+	if (!(sum > 0))
+		return -1;
+
+	table->n = n;
+	table->prob = malloc(n * sizeof(double));
+	CHKALLOC(table->prob);
+	table->alias = malloc(n * sizeof(uint32_t));
+	CHKALLOC(table->alias);
+	/* work lists of indices with a scaled weight below and above
+	 * one, small grows from the front and large from the back of
+	 * the same array */
+	uint32_t *const work = malloc(n * sizeof(uint32_t));
+	CHKALLOC(work);
+	uint32_t small = 0;
+	uint32_t large = n;
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		table->prob[i] = weights[i] * n / sum;
+		table->alias[i] = i;
+		if (table->prob[i] < 1.0)
+			work[small++] = i;
+		else
+			work[--large] = i;
+	}
+	/* fill up each small column with the excess of a large one,
+	 * which may become small itself */
+	uint32_t s = 0;
+	while (s < small && large < n)
+	{
+		const uint32_t l = work[large];
+		const uint32_t i = work[s++];
+		table->alias[i] = l;
+		table->prob[l] -= 1.0 - table->prob[i];
+		if (table->prob[l] < 1.0)
+		{
+			/* the small list ends where the large list
+			 * starts, so this moves l between them */
+			large++;
+			work[small++] = l;
+		}
+	}
+	/* columns left over only differ from one by rounding
+	 * errors */
+	for (; s < small; s++)
+		table->prob[work[s]] = 1.0;
+	for (; large < n; large++)
+		table->prob[work[large]] = 1.0;
+
+	free(work);
+	return 0;
+}
+
+
+
+void alias_table_free(struct alias_table *table)
+{
+	free(table->prob);
+	free(table->alias);
+	table->prob = NULL;
+	table->alias = NULL;
+	table->n = 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_ALIAS_H__
+#define __LUNA_ALIAS_H__
+
+#include <stdint.h>
+
+/*
+ * Alias table for sampling from a discrete distribution over the
+ * indices 0 to n - 1 in constant time (Walker's alias method, built
+ * using Vose's algorithm). Index i is returned with a probability
+ * proportional to the weight it was initialized with.
+ */
+struct alias_table
+{
+	uint32_t n;
+	/* probability of keeping index i rather than returning
+	 * alias[i] */
+	double *prob;
+	uint32_t *alias;
+};
+
+/* Build the table for the n weights. Returns 0 on success, -1 if n
+ * is zero, a weight is negative, or all weights are zero. */
+int alias_table_init(struct alias_table *table, const double *const weights,
+		     const uint32_t n);
+
+/* Free the memory allocated by alias_table_init */
+void alias_table_free(struct alias_table *table);
+
+/* Draw an index using the random value u, uniformly distributed in
+ * [0, 1). The single value selects both the column and whether to
+ * take its alias. */
+static inline uint32_t alias_table_pick(const struct alias_table *const table,
+					const double u)
+{
+	const double x = u * table->n;
+	const uint32_t i = (uint32_t) x;
+	return (x - i) < table->prob[i] ? i : table->alias[i];
+}
+
+#endif /* __LUNA_ALIAS_H__ */
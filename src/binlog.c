@@ -0,0 +1,209 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "binlog.h"
+#include "luna.h"
+
+_Static_assert(sizeof(struct binlog_header) == 32,
+	       "unexpected binary log header size");
+_Static_assert(sizeof(struct binlog_record) == 32,
+	       "unexpected binary log record size");
+
+
+
+void binlog_init_header(struct binlog_header *const hdr, const uint16_t type,
+			const uint16_t flags)
+{
+	memset(hdr, 0, sizeof(struct binlog_header));
+	memcpy(hdr->magic, BINLOG_MAGIC, sizeof(BINLOG_MAGIC));
+	hdr->version = BINLOG_VERSION;
+	hdr->record_size = sizeof(struct binlog_record);
+	hdr->type = type;
+	hdr->flags = flags;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	hdr->created = timespec_to_ns(&now);
+}
+
+
+
+void binlog_write_header(FILE *const out, const uint16_t type,
+			 const uint16_t flags)
+{
+	/* Large buffer to keep the number of write() calls low, the
+	 * buffer is allocated by the first write below. */
+	setvbuf(out, NULL, _IOFBF, BINLOG_BUF_SIZE);
+
+	struct binlog_header hdr;
+	binlog_init_header(&hdr, type, flags);
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+	{
+		perror("Writing binary log header");
+		exit(EXIT_FILEFAIL);
+	}
+}
+
+
+
+void binlog_fill_packet(struct binlog_record *const rec, const uint32_t flow,
+			const uint8_t flags, const struct timespec *const time,
+			const int64_t value, const int64_t sequence,
+			const uint16_t size)
+{
+	rec->type = BINLOG_REC_PACKET;
+	rec->flags = flags;
+	rec->size = size;
+	rec->flow = flow;
+	rec->data.packet.time = timespec_to_ns(time);
+	rec->data.packet.value = value;
+	rec->data.packet.sequence = sequence;
+}
+
+
+
+void binlog_fill_flow(struct binlog_record *const rec, const uint32_t flow,
+		      const struct sockaddr *const addr)
+{
+	memset(rec, 0, sizeof(struct binlog_record));
+	rec->type = BINLOG_REC_FLOW;
+	rec->flow = flow;
+	rec->data.flow.family = addr->sa_family;
+	if (addr->sa_family == AF_INET)
+	{
+		const struct sockaddr_in *const in =
+			(const struct sockaddr_in *) addr;
+		rec->data.flow.port = in->sin_port;
+		memcpy(rec->data.flow.addr, &(in->sin_addr),
+		       sizeof(struct in_addr));
+	}
+	else if (addr->sa_family == AF_INET6)
+	{
+		const struct sockaddr_in6 *const in6 =
+			(const struct sockaddr_in6 *) addr;
+		rec->data.flow.port = in6->sin6_port;
+		memcpy(rec->data.flow.addr, &(in6->sin6_addr),
+		       sizeof(struct in6_addr));
+	}
+}
+
+
+
+void binlog_write_packet(FILE *const out, const uint32_t flow,
+			 const uint8_t flags, const struct timespec *const time,
+			 const int64_t value, const int64_t sequence,
+			 const uint16_t size)
+{
+	struct binlog_record rec;
+	binlog_fill_packet(&rec, flow, flags, time, value, sequence, size);
+	fwrite(&rec, sizeof(rec), 1, out);
+}
+
+
+
+void binlog_write_stamped_packet(FILE *const out, const uint32_t flow,
+				 const uint8_t flags,
+				 const struct timespec *const time,
+				 const int64_t value, const int64_t sequence,
+				 const uint16_t size, const int64_t server_rx,
+				 const int64_t server_tx)
+{
+	struct binlog_record rec[2];
+	binlog_fill_packet(&(rec[0]), flow, flags, time, server_tx,
+			   sequence, size);
+	rec[0].type = BINLOG_REC_STAMPS;
+	rec[0].data.packet.time = server_rx;
+	binlog_fill_packet(&(rec[1]), flow, flags, time, value, sequence, size);
+	fwrite(rec, sizeof(struct binlog_record), 2, out);
+}
+
+
+
+int binlog_flow_names(const struct binlog_record *const rec,
+		      struct binlog_flow_names *const names)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	memset(&addr, 0, sizeof(addr));
+	names->valid = 0;
+	if (rec->data.flow.family == AF_INET)
+	{
+		struct sockaddr_in *const in = (struct sockaddr_in *) &addr;
+		in->sin_family = AF_INET;
+		in->sin_port = rec->data.flow.port;
+		memcpy(&(in->sin_addr), rec->data.flow.addr,
+		       sizeof(struct in_addr));
+		addrlen = sizeof(struct sockaddr_in);
+	}
+	else if (rec->data.flow.family == AF_INET6)
+	{
+		struct sockaddr_in6 *const in6 = (struct sockaddr_in6 *) &addr;
+		in6->sin6_family = AF_INET6;
+		in6->sin6_port = rec->data.flow.port;
+		memcpy(&(in6->sin6_addr), rec->data.flow.addr,
+		       sizeof(struct in6_addr));
+		addrlen = sizeof(struct sockaddr_in6);
+	}
+	else
+		return -1;
+
+	/* disable name resolution (would require DNS requests) */
+	if (getnameinfo((struct sockaddr *) &addr, addrlen,
+			names->addr, BINLOG_NAME_LEN,
+			names->port, BINLOG_NAME_LEN,
+			NI_DGRAM | NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+		return -1;
+	names->valid = 1;
+	return 0;
+}
+
+
+
+int binlog_read_header(FILE *const in, struct binlog_header *const hdr)
+{
+	if (fread(hdr, sizeof(struct binlog_header), 1, in) != 1)
+	{
+		fprintf(stderr, "Could not read binary log header.\n");
+		return -1;
+	}
+	if (memcmp(hdr->magic, BINLOG_MAGIC, sizeof(BINLOG_MAGIC)) != 0)
+	{
+		fprintf(stderr, "Input is not a LUNA binary log.\n");
+		return -1;
+	}
+	if (hdr->version != BINLOG_VERSION)
+	{
+		fprintf(stderr, "Unsupported binary log version %u (log "
+			"written on a host with different byte order?)\n",
+			hdr->version);
+		return -1;
+	}
+	if (hdr->record_size != sizeof(struct binlog_record))
+	{
+		fprintf(stderr, "Unexpected record size %u in binary log.\n",
+			hdr->record_size);
+		return -1;
+	}
+	return 0;
+}
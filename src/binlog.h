@@ -0,0 +1,182 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_BINLOG_H__
+#define __LUNA_BINLOG_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <time.h>
+
+/*
+ * Binary log format: A struct binlog_header followed by any number of
+ * struct binlog_record. All values are in host byte order, the
+ * version field doubles as byte order check. Both structures are 32
+ * bytes without padding.
+ *
+ * Packet records refer to their flow (source address and port on the
+ * server, sender thread on the client) by ID. On the server, a flow
+ * record with the address of a flow is written before the first
+ * packet record of that flow.
+ */
+
+/* log formats selectable for the output of server and client */
+#define LOG_FORMAT_TEXT 0
+#define LOG_FORMAT_BINARY 1
+/* no per-packet log (server only) */
+#define LOG_FORMAT_NONE 2
+
+#define BINLOG_MAGIC "LUNALOG"
+/* version 2: 64 bit sequence numbers, the packet size moved to the
+ * common part of the record */
+#define BINLOG_VERSION 2
+
+/* log types (struct binlog_header.type) */
+/* server receive log, value is the user space receive time if
+ * BINLOG_FLAG_KUTIME is set */
+#define BINLOG_TYPE_SERVER 1
+/* client echo log, value is the round trip time */
+#define BINLOG_TYPE_ECHO 2
+/* client transmit timestamp log */
+#define BINLOG_TYPE_TXSTAMP 3
+
+/* log flags (struct binlog_header.flags) */
+#define BINLOG_FLAG_KUTIME 1
+/* echo log with server timestamps, see BINLOG_REC_STAMPS */
+#define BINLOG_FLAG_STAMPS 2
+
+/* record types (struct binlog_record.type) */
+#define BINLOG_REC_PACKET 1
+#define BINLOG_REC_FLOW 2
+/* server timestamps of the echo described by the packet record that
+ * follows, using the packet fields: time is the server's kernel
+ * receive time, value the time the echo was sent */
+#define BINLOG_REC_STAMPS 3
+
+/* record flags for BINLOG_TYPE_TXSTAMP: the timestamp is a hardware
+ * timestamp */
+#define BINLOG_TX_HARDWARE 1
+
+/* flow ID for packets of flows that did not get their own ID,
+ * each of their packet records follows a flow record with this ID */
+#define BINLOG_FLOW_OTHER UINT32_MAX
+
+/* stdio buffer size for binary logs */
+#define BINLOG_BUF_SIZE (1024 * 1024)
+/* length for address and port strings (probably a bit longer than
+ * required) */
+#define BINLOG_NAME_LEN 64
+
+struct binlog_header
+{
+	char magic[8];
+	uint16_t version;
+	uint16_t record_size;
+	uint16_t type;
+	uint16_t flags;
+	/* realtime clock when the log was created (ns) */
+	int64_t created;
+	uint64_t reserved;
+};
+
+struct binlog_record
+{
+	uint8_t type;
+	/* flags byte of the packet for packet records on server and
+	 * echo logs, BINLOG_TX_* for transmit timestamps */
+	uint8_t flags;
+	/* packet size (packet records) */
+	uint16_t size;
+	uint32_t flow;
+	union
+	{
+		struct
+		{
+			/* kernel timestamp (ns) */
+			int64_t time;
+			/* meaning depends on the log type (ns) */
+			int64_t value;
+			int64_t sequence;
+		} packet;
+		struct
+		{
+			uint16_t family;
+			/* network byte order */
+			uint16_t port;
+			uint32_t reserved;
+			/* IPv4 addresses use the first four bytes */
+			uint8_t addr[16];
+		} flow;
+	} data;
+};
+
+/* source address and port of a flow as text */
+struct binlog_flow_names
+{
+	int valid;
+	char addr[BINLOG_NAME_LEN];
+	char port[BINLOG_NAME_LEN];
+};
+
+/* Fill in a header for a new log */
+void binlog_init_header(struct binlog_header *const hdr, const uint16_t type,
+			const uint16_t flags);
+
+/* Set up buffering for out and write the log header. Must be called
+ * before anything else is written to out. */
+void binlog_write_header(FILE *const out, const uint16_t type,
+			 const uint16_t flags);
+
+/* Fill in a packet record */
+void binlog_fill_packet(struct binlog_record *const rec, const uint32_t flow,
+			const uint8_t flags, const struct timespec *const time,
+			const int64_t value, const int64_t sequence,
+			const uint16_t size);
+
+/* Fill in a flow record for a flow with the given source address */
+void binlog_fill_flow(struct binlog_record *const rec, const uint32_t flow,
+		      const struct sockaddr *const addr);
+
+/* Write a packet record */
+void binlog_write_packet(FILE *const out, const uint32_t flow,
+			 const uint8_t flags, const struct timespec *const time,
+			 const int64_t value, const int64_t sequence,
+			 const uint16_t size);
+
+/* Write a packet record preceded by a record with the server
+ * timestamps (ns) of the packet (BINLOG_REC_STAMPS), with a single
+ * call */
+void binlog_write_stamped_packet(FILE *const out, const uint32_t flow,
+				 const uint8_t flags,
+				 const struct timespec *const time,
+				 const int64_t value, const int64_t sequence,
+				 const uint16_t size, const int64_t server_rx,
+				 const int64_t server_tx);
+
+/* Convert the address in a flow record to text (numeric, no name
+ * resolution). Returns 0 on success, -1 if the address is invalid. */
+int binlog_flow_names(const struct binlog_record *const rec,
+		      struct binlog_flow_names *const names);
+
+/* Read and check the log header. Returns 0 on success, -1 if in
+ * does not start with a valid header (a message explaining the
+ * problem is written to stderr). */
+int binlog_read_header(FILE *const in, struct binlog_header *const hdr);
+
+#endif /* __LUNA_BINLOG_H__ */
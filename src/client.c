@@ -19,15 +19,18 @@
 #include <config.h>
 
 #include <arpa/inet.h>
-#include <linux/sockios.h>
+#include <linux/net_tstamp.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/time.h>
@@ -36,97 +39,136 @@
 #include <unistd.h>
 
 #include "luna.h"
+#include "binlog.h"
+#include "client.h"
+#include "clockoffset.h"
+#include "flowstats.h"
 #include "generator.h"
+#include "histogram.h"
+#include "protocol.h"
+#include "sender.h"
+#include "sweep.h"
 #include "traffic.h"
+#include "txstamp.h"
 #include "simple_generator.h"
 #include "gaussian_generator.h"
+#include "distribution_generator.h"
+#include "empirical_generator.h"
+#include "mmpp_generator.h"
+#include "replay_generator.h"
 
 
 
 /* List of known generators */
-#define KNOWN_GENERATORS_LENGTH 4
+#define KNOWN_GENERATORS_LENGTH 8
 static const struct generator_type known_generators[] = {
 	{"static", &static_generator_create},
 	{"random_size", &rand_size_generator_create},
 	{"alt_time", &alternate_time_generator_create},
 	{"gaussian", &gaussian_generator_create},
+	{"distribution", &distribution_generator_create},
+	{"mmpp", &mmpp_generator_create},
+	{"replay", &replay_generator_create},
+	{"empirical", &empirical_generator_create},
 };
 
 
 
 #define ECHO_PRIO_OFFSET 2
+/* After sending, wait for outstanding echoes for ECHO_DRAIN_FACTOR
+ * times the largest RTT seen, but at least ECHO_DRAIN_MIN and at most
+ * ECHO_DRAIN_MAX (ns). Without any echo so far, wait ECHO_DRAIN_MAX.
+ * Completion is checked every ECHO_DRAIN_POLL ns. */
+#define ECHO_DRAIN_FACTOR 2
+#define ECHO_DRAIN_MIN (10000 * NS_PER_US)
+#define ECHO_DRAIN_MAX ((int64_t) NS_PER_S)
+#define ECHO_DRAIN_POLL (1000 * NS_PER_US)
+/* size of the closed-loop echo queues relative to the number of
+ * request slots */
+#define ECHO_QUEUE_FACTOR 4
 
 void* echo_thread(void *arg);
-void _fclose_wrapper(void *arg);
 
 struct echo_thread_data
 {
 	/* socket to read from */
 	int sock;
 	/* post to this semaphore when init is done */
-	sem_t sem;
-	/* output file or NULL */
-	const char *datafile;
+	sem_t *sem;
+	/* output file, shared by all echo threads */
+	FILE *dataout;
+	/* LOG_FORMAT_* */
+	int format;
+	/* ID of the sender the socket belongs to, used as flow ID in
+	 * binary logs */
+	int id;
+	/* log server timestamps? */
+	int server_stamps;
+	/* server clock offset estimate, based on server timestamps */
+	struct clock_offset *offset;
+	/* sequence numbers of the echoes received, to count lost and
+	 * duplicate echoes */
+	struct flow_stats *echoes;
+	/* number of distinct echoes and largest RTT (ns) so far,
+	 * read by run_client() while waiting for outstanding
+	 * echoes */
+	atomic_llong answered;
+	atomic_llong max_rtt;
+	/* RTT distribution over the whole run, and since the last
+	 * interval report */
+	struct histogram *rtt;
+	struct histogram *rtt_interval;
+	/* interval for RTT reports (s), 0 for none */
+	int stats_interval;
+	/* rate sweep: RTT distributions and numbers of distinct
+	 * echoes of the current and the previous step, the current
+	 * one has index step & 1. An echo counts for the current step
+	 * only if its sequence number is at least step_first of the
+	 * step, late echoes of earlier steps are ignored. While
+	 * run_sweep() prepares the next step, the echo thread still
+	 * writes to the other index. rtt_step is NULL without
+	 * sweep. */
+	struct histogram *rtt_step;
+	atomic_llong step_answered[2];
+	atomic_llong step_first[2];
+	atomic_int step;
+	/* closed-loop mode: queue to report received echoes to the
+	 * sender, NULL in open-loop mode */
+	struct echo_queue *queue;
 };
 
 
 
-int run_client(struct addrinfo *addr, const int time,
-	       const struct timespec start_time, const clockid_t clk_id,
-	       const int echo,
-	       const char *const generator_type,
-	       const char *const generator_args,
-	       const char *const datafile)
+/* Create and initialize the configured generator in *generator,
+ * exits if the generator is unknown. */
+static void create_generator(generator_t *const generator,
+			     const struct client_config *const config)
 {
-	fprintf(stderr, "Generator: %s\n", generator_type);
-
-	sem_t semaphore;
-	sem_t ready_sem;
-	sem_init(&semaphore, 0, 0); /* TODO: Error handling */
-	sem_init(&ready_sem, 0, 0); /* TODO: Error handling */
-	generator_t generator;
-	memset(&generator, 0, sizeof(generator_t));
-	generator.control = &semaphore;
-	generator.ready = &ready_sem;
-
-	/* initialize the requested generator */
 	for (int i = 0; i < KNOWN_GENERATORS_LENGTH; i++)
 	{
 		generator_option *const gen_args =
-			split_generator_args(generator_args);
-		if (strcmp(generator_type, known_generators[i].name) == 0)
-			known_generators[i].create(&generator, gen_args);
+			split_generator_args(config->generator_args);
+		if (strcmp(config->generator_type,
+			   known_generators[i].name) == 0)
+			known_generators[i].create(generator, gen_args);
 		free_generator_args(gen_args);
 	}
 	/* fail if the requested generator is unknown */
-	if (generator.init_generator == NULL)
+	if (generator->init_generator == NULL)
 	{
 		fprintf(stderr, "ERROR: Unknown generator "
-			"\"%s\"!\n", generator_type);
+			"\"%s\"!\n", config->generator_type);
 		exit(EXIT_INVALID);
 	}
+}
 
-	/* also used for echo thread, if any */
-	pthread_attr_t thread_attrs;
-	pthread_attr_init(&thread_attrs);
-
-	pthread_attr_setstacksize(&thread_attrs, 2 * PTHREAD_STACK_MIN);
-	pthread_t gen_thread;
-	int ret = pthread_create(&gen_thread, &thread_attrs, &run_generator, &generator);
-	if (ret != 0)
-	{
-		fprintf(stderr, "creating generator thread failed: %s\n",
-			strerror(ret));
-		exit(1);
-	}
 
-	/* Allocate buffer, based on upper size limit provided by the
-	 * generator */
-	char *const buf = malloc(generator.max_size);
-	CHKALLOC(buf);
-	memset(buf, 7, generator.max_size);
 
-	struct addrinfo *rp;
+/* Create a UDP socket connected to the first usable address in
+ * addr. Exits if no connection is possible. */
+static int connect_socket(const struct addrinfo *const addr)
+{
+	const struct addrinfo *rp;
 	int sock;
 	for (rp = addr; rp != NULL; rp = rp->ai_next)
 	{
@@ -144,142 +186,626 @@ int run_client(struct addrinfo *addr, const int time,
 		fprintf(stderr, "Could not create socket.\n");
 		exit(EXIT_NETFAIL);
 	}
+	return sock;
+}
+
+
+
+/* Find out which protocol version the server supports, using the
+ * negotiation described in protocol.h on the connected socket sock.
+ * Falls back to version 1 if the server does not reply. */
+static int negotiate_protocol(const int sock)
+{
+	char buf[MSG_BUF_SIZE];
+	memset(buf, 0, MIN_PACKET_SIZE);
+	const struct packet_header hello = {
+		.sequence = PROTOCOL_HELLO_SEQ,
+		.send_time = 0,
+		.flow = 0,
+		.flags = LUNA_FLAG_HELLO | LUNA_FLAG_ECHO,
+		.version = PROTOCOL_V1,
+		.length = PROTOCOL_V1_HEADER_SIZE
+	};
+	struct pollfd pfd = {sock, POLLIN, 0};
+	for (int i = 0; i < PROTOCOL_HELLO_TRIES; i++)
+	{
+		packet_write_header(buf, &hello);
+		if (send(sock, buf, MIN_PACKET_SIZE, 0) == -1)
+		{
+			perror("Sending protocol negotiation");
+			break;
+		}
+		if (poll(&pfd, 1, PROTOCOL_HELLO_TIMEOUT) < 1)
+			continue;
+		struct packet_header reply;
+		const ssize_t len = recv(sock, buf, MSG_BUF_SIZE, 0);
+		if (packet_read_header(buf, len, &reply) != 0
+		    || !(reply.flags & LUNA_FLAG_HELLO))
+			continue;
+		/* older servers echo the packet unchanged */
+		if (reply.version <= PROTOCOL_V1)
+			return PROTOCOL_V1;
+		return reply.version < PROTOCOL_VERSION ?
+			reply.version : PROTOCOL_VERSION;
+	}
+	fprintf(stderr, "No reply to protocol negotiation, using protocol "
+		"version 1.\n");
+	return PROTOCOL_V1;
+}
+
+
+
+/* Wait until each echo thread has received an echo for every packet
+ * its sender sent, or the drain timeout (see ECHO_DRAIN_FACTOR)
+ * expires. extra (ns) is added to the timeout. */
+static void drain_echoes(const struct sender *const senders,
+			 struct echo_thread_data *const e_data,
+			 const int threads, const int64_t extra)
+{
+	int64_t timeout = 0;
+	for (int i = 0; i < threads; i++)
+	{
+		const int64_t max_rtt = atomic_load(&(e_data[i].max_rtt));
+		if (max_rtt > timeout)
+			timeout = max_rtt;
+	}
+	timeout *= ECHO_DRAIN_FACTOR;
+	if (timeout == 0 || timeout > ECHO_DRAIN_MAX)
+		timeout = ECHO_DRAIN_MAX;
+	else if (timeout < ECHO_DRAIN_MIN)
+		timeout = ECHO_DRAIN_MIN;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	const int64_t deadline = timespec_to_ns(&now) + timeout + extra;
+	const struct timespec poll = {0, ECHO_DRAIN_POLL};
+	while (timespec_to_ns(&now) < deadline)
+	{
+		int done = 1;
+		for (int i = 0; i < threads && done; i++)
+			if (atomic_load(&(e_data[i].answered))
+			    < senders[i].state.seq)
+				done = 0;
+		if (done)
+			return;
+		clock_nanosleep(CLOCK_MONOTONIC, 0, &poll, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	}
+}
+
+
+
+/* Report sent, lost, duplicate and late echoes of a sender */
+static void report_echoes(FILE *const out, const int id, const int64_t sent,
+			  const struct flow_stats *const echoes)
+{
+	/* late echoes (more than FLOW_STATS_WINDOW sequence numbers
+	 * behind) may be duplicates, too, but that can't be told */
+	const int64_t answered = echoes->c.received - echoes->c.duplicates;
+	const int64_t lost = sent > answered ? sent - answered : 0;
+	fprintf(out, "Sender %i echoes: %" PRId64 " sent, %" PRId64
+		" received, %" PRId64 " lost (%.3f%%), %" PRId64
+		" duplicates, %" PRId64 " late\n", id, sent, answered, lost,
+		sent > 0 ? 100.0 * lost / sent : 0.0,
+		echoes->c.duplicates, echoes->c.late);
+}
+
+
+
+/* Print how far the generator of sender id stayed ahead of it */
+static void report_generator(const int id, const generator_t *const generator)
+{
+	const struct generator_stats *const stats = &(generator->stats);
+	if (generator->fill_block == NULL || stats->refills == 0)
+		return;
+	fprintf(stderr, "Generator %i: %lu blocks of %i packets, refilling "
+		"took %.1fµs on average (max. %.1fµs) per %.1fµs of "
+		"schedule, at least %lu blocks ready.\n", id,
+		generator->ring->count, stats->block_len,
+		(double) stats->fill_time / stats->refills / NS_PER_US,
+		(double) stats->max_fill_time / NS_PER_US,
+		(double) stats->schedule_time / stats->refills / NS_PER_US,
+		stats->min_ready);
+}
+
+
+
+/* Create the generators of all senders, start their threads and
+ * wait until they are ready. If rate is positive, the generators
+ * are scaled to send rate packets/s in total. */
+static void start_generators(struct sender *const senders,
+			     const struct client_config *const config,
+			     const pthread_attr_t *const attrs,
+			     const double rate)
+{
+	for (int i = 0; i < config->threads; i++)
+	{
+		struct sender *const s = &(senders[i]);
+		memset(&(s->generator), 0, sizeof(generator_t));
+		if (sem_init(&(s->ready), 0, 0) != 0)
+		{
+			perror("Initializing generator semaphore");
+			exit(EXIT_MEMFAIL);
+		}
+		s->generator.ready = &(s->ready);
+		s->generator.id = i;
+		/* in closed-loop mode the generator provides think
+		 * times, which each sender uses on its own */
+		s->generator.split =
+			config->closed_loop > 0 ? 1 : config->threads;
+		s->generator.rate = rate;
+		s->generator.hugepages = config->hugepages;
+		s->generator.buffer_time = config->buffer_time;
+		create_generator(&(s->generator), config);
+		const int ret = pthread_create(&(s->gen_thread), attrs,
+					       &run_generator,
+					       &(s->generator));
+		if (ret != 0)
+		{
+			fprintf(stderr, "creating generator thread failed: "
+				"%s\n", strerror(ret));
+			exit(1);
+		}
+	}
+	for (int i = 0; i < config->threads; i++)
+		sem_wait(&(senders[i].ready));
+}
+
+
+
+/* Start the sender threads with the given settings, wait until they
+ * are done and free the generators. barrier and start are the ones
+ * the senders refer to. The sender statistics are reported for this
+ * run only, the return value is the number of buffer underruns
+ * during it. */
+static long run_senders(struct sender *const senders,
+			const struct client_config *const config,
+			const pthread_attr_t *const attrs,
+			pthread_barrier_t *const barrier,
+			struct timespec *const start)
+{
+	const int threads = config->threads;
+	/* counters before this run, the senders keep counting across
+	 * sweep steps */
+	struct send_state *const before =
+		malloc(threads * sizeof(struct send_state));
+	CHKALLOC(before);
+	long underruns = 0;
+	for (int i = 0; i < threads; i++)
+	{
+		before[i] = senders[i].state;
+		senders[i].config = config;
+		const int ret = pthread_create(&(senders[i].thread), attrs,
+					       &sender_thread, &(senders[i]));
+		if (ret != 0)
+		{
+			fprintf(stderr, "creating sender thread failed: %s\n",
+				strerror(ret));
+			exit(1);
+		}
+	}
+
+	/* wait until all senders are ready */
+	pthread_barrier_wait(barrier);
+	/* if start_time is zeroed, just use "now" */
+	if (config->start_time.tv_sec == 0 && config->start_time.tv_nsec == 0)
+		clock_gettime(config->clk_id, start);
+	/* otherwise initialize start to start_time */
+	else
+	{
+		start->tv_sec = config->start_time.tv_sec;
+		start->tv_nsec = config->start_time.tv_nsec;
+	}
+	pthread_barrier_wait(barrier);
+
+	for (int i = 0; i < threads; i++)
+	{
+		struct sender *const s = &(senders[i]);
+		pthread_join(s->thread, NULL);
+		const struct send_state *const b = &(before[i]);
+		const long s_underruns = s->state.underruns - b->underruns;
+		const long completed = s->state.completed - b->completed;
+		underruns += s_underruns;
+		const long send_errors = s->state.send_errors - b->send_errors;
+		if (send_errors > 0)
+			fprintf(stderr, "Sender %i: %ld of %" PRId64 " packets "
+				"could not be sent.\n", i, send_errors,
+				s->state.seq - b->seq);
+		if (config->send_mode == SEND_MODE_SPIN)
+			fprintf(stderr, "Sender %i: spin timer woke up too "
+				"late for %ld of %" PRId64 " packets.\n", i,
+				s->state.spin_misses - b->spin_misses,
+				s->state.seq - b->seq);
+		if (s_underruns > 0 && config->underrun == UNDERRUN_STALL)
+			fprintf(stderr, "Sender %i: %ld buffer underruns, "
+				"stalled for %" PRId64 "µs in total.\n", i,
+				s_underruns,
+				(s->state.stall_time - b->stall_time)
+				/ NS_PER_US);
+		else if (s_underruns > 0)
+			fprintf(stderr, "Sender %i: %ld buffer underruns.\n",
+				i, s_underruns);
+		if (config->closed_loop > 0)
+			fprintf(stderr, "Sender %i: %ld requests completed "
+				"(%.1f/s), %ld timed out.\n", i, completed,
+				(double) completed / config->time,
+				s->state.timeouts - b->timeouts);
+
+		/* free up generator resources after it has
+		 * terminated */
+		pthread_cancel(s->gen_thread);
+		pthread_join(s->gen_thread, NULL);
+		report_generator(i, &(s->generator));
+		s->generator.destroy_generator(&(s->generator));
+		free(s->generator.ring);
+		sem_destroy(&(s->ready));
+	}
+	free(before);
+	return underruns;
+}
+
+
+
+/*
+ * Rate sweep: run the senders repeatedly for config->time seconds
+ * each, at the rates chosen by a struct sweep, and check after each
+ * step whether the senders kept up without buffer underruns and
+ * whether the echo loss and the 99th percentile RTT of the step met
+ * the objectives. Echoes are assigned to the step that sent them by
+ * their sequence number. Between steps, outstanding echoes are
+ * drained, echoes arriving later count as lost.
+ */
+static void run_sweep(struct sender *const senders,
+		      struct echo_thread_data *const e_data,
+		      const struct client_config *const config,
+		      const pthread_attr_t *const attrs,
+		      pthread_barrier_t *const barrier,
+		      struct timespec *const start)
+{
+	const int threads = config->threads;
+	/* only the first step waits for the start time */
+	struct client_config step_config = *config;
+	struct histogram *const rtt = malloc(sizeof(struct histogram));
+	CHKALLOC(rtt);
+	touch_page(rtt, sizeof(struct histogram));
+	int64_t *const sent = calloc(threads, sizeof(int64_t));
+	CHKALLOC(sent);
+
+	struct sweep sweep;
+	sweep_init(&sweep, config->sweep_min, config->sweep_max,
+		   config->sweep_step);
+	for (double rate = sweep_next(&sweep); rate > 0;
+	     rate = sweep_next(&sweep))
+	{
+		const int step = sweep.steps;
+		const int slot = step & 1;
+		for (int i = 0; i < threads; i++)
+		{
+			/* the echo thread still uses the other slot
+			 * until step is set */
+			sent[i] = senders[i].state.seq;
+			histogram_reset(&(e_data[i].rtt_step[slot]));
+			atomic_store(&(e_data[i].step_answered[slot]), 0);
+			atomic_store(&(e_data[i].step_first[slot]), sent[i]);
+			atomic_store(&(e_data[i].step), step);
+		}
+		fprintf(stderr, "Sweep step %i: %.1f packets/s\n", step, rate);
+		start_generators(senders, &step_config, attrs, rate);
+		const long underruns = run_senders(senders, &step_config,
+						   attrs, barrier, start);
+		step_config.start_time.tv_sec = 0;
+		step_config.start_time.tv_nsec = 0;
+		drain_echoes(senders, e_data, threads,
+			     config->send_mode == SEND_MODE_TXTIME ?
+			     config->lead_time : 0);
+
+		int64_t step_sent = 0;
+		int64_t step_answered = 0;
+		histogram_reset(rtt);
+		for (int i = 0; i < threads; i++)
+		{
+			step_sent += senders[i].state.seq - sent[i];
+			step_answered +=
+				atomic_load(&(e_data[i].step_answered[slot]));
+			histogram_merge(rtt, &(e_data[i].rtt_step[slot]));
+		}
+		const int64_t lost = step_sent > step_answered ?
+			step_sent - step_answered : 0;
+		const double loss = step_sent > 0 ?
+			100.0 * lost / step_sent : 100.0;
+		const int64_t p99 = histogram_quantile(rtt, 0.99);
+		/* with underruns the senders did not reach the rate */
+		const int ok = underruns == 0 && loss <= config->slo_loss
+			&& (config->slo_rtt == 0 || p99 <= config->slo_rtt);
+		char name[64];
+		snprintf(name, sizeof(name), "Sweep step %i RTT", step);
+		histogram_report(stderr, name, rtt);
+		fprintf(stderr, "Sweep step %i: %.1f packets/s, %" PRId64
+			" sent, %" PRId64 " lost (%.3f%%), %ld underruns, "
+			"%s\n", step, rate, step_sent, lost, loss, underruns,
+			ok ? "passed" : "FAILED");
+		sweep_result(&sweep, rate, ok);
+	}
+
+	if (sweep.best > 0)
+		fprintf(stderr, "Sweep: highest rate meeting the objectives: "
+			"%.1f packets/s\n", sweep.best);
+	else
+		fprintf(stderr, "Sweep: no rate met the objectives\n");
+	free(sent);
+	free(rtt);
+}
+
+
+
+int run_client(struct addrinfo *addr, const struct client_config *const config)
+{
+	fprintf(stderr, "Generator: %s\n", config->generator_type);
+
+	const int threads = config->threads;
+	struct sender *const senders = calloc(threads, sizeof(struct sender));
+	CHKALLOC(senders);
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, threads + 1);
+	struct timespec start = {0, 0};
+
+	/* also used for echo and sender threads */
+	pthread_attr_t thread_attrs;
+	pthread_attr_init(&thread_attrs);
+	pthread_attr_setstacksize(&thread_attrs, 2 * PTHREAD_STACK_MIN);
+
+	int ret = 0;
+	for (int i = 0; i < threads; i++)
+	{
+		struct sender *const s = &(senders[i]);
+		s->id = i;
+		/* only pin threads if there is more than one */
+		s->cpu = threads > 1 ? i % cpus : -1;
+		s->config = config;
+		s->barrier = &barrier;
+		s->start = &start;
+		s->state.sock = connect_socket(addr);
+		if (threads > 1)
+		{
+			struct sockaddr_storage local;
+			socklen_t len = sizeof(local);
+			getsockname(s->state.sock,
+				    (struct sockaddr *) &local, &len);
+			char portstr[DEFAULT_PORT_LEN];
+			getnameinfo((struct sockaddr *) &local, len,
+				    NULL, 0, portstr, DEFAULT_PORT_LEN,
+				    NI_DGRAM | NI_NUMERICSERV);
+			fprintf(stderr, "Sender %i: CPU %i, source port %s\n",
+				i, s->cpu, portstr);
+		}
+	}
 	freeaddrinfo(addr); // no longer required
 
-	/* prepare and start echo handler thread, if requested */
-	pthread_t e_thread;
+	/* Negotiate the protocol version before the echo threads
+	 * start, so they don't get the reply. */
+	int version = config->protocol;
+	if (version == PROTOCOL_AUTO)
+	{
+		version = negotiate_protocol(senders[0].state.sock);
+		fprintf(stderr, "Protocol version %i\n", version);
+	}
+	for (int i = 0; i < threads; i++)
+	{
+		senders[i].state.version = version;
+		senders[i].state.flow = i;
+	}
+
+	/* Open echo output file if specified. Each sender gets its own
+	 * echo handler thread, all of them write to the same file. */
+	FILE *dataout = stdout;
+	if (config->echo && config->datafile != NULL)
+	{
+		dataout = fopen(config->datafile, "w");
+		if (dataout == NULL)
+		{
+			perror("Opening output file in run_client");
+			exit(EXIT_FILEFAIL);
+		}
+	}
+
+	/* prepare and start echo handler threads, if requested */
+	sem_t e_sem;
 	struct echo_thread_data *e_data = NULL;
-	if (echo)
+	pthread_t *e_threads = NULL;
+	if (config->echo)
 	{
-		e_data = malloc(sizeof(struct echo_thread_data));
+		if (config->log_format == LOG_FORMAT_BINARY)
+			binlog_write_header(dataout, BINLOG_TYPE_ECHO,
+					    config->server_stamps ?
+					    BINLOG_FLAG_STAMPS : 0);
+		else if (config->server_stamps)
+			fprintf(dataout, "# ktime\tsequence\tsize\trtt\t"
+				"forward\treverse\tresidence\toffset\n");
+		else
+			fprintf(dataout, "# ktime\tsequence\tsize\trtt\n");
+		if (sem_init(&e_sem, 0, 0) != 0)
+		{
+			perror("Initializing echo semaphore");
+			exit(EXIT_MEMFAIL);
+		}
+		e_data = calloc(threads, sizeof(struct echo_thread_data));
 		CHKALLOC(e_data);
-		touch_page(e_data, sizeof(struct echo_thread_data));
-		e_data->sock = sock;
-		e_data->datafile = datafile;
-		sem_init(&(e_data->sem), 0, 0); /* TODO: Error handling */
-		ret = pthread_create(&e_thread, &thread_attrs, &echo_thread, e_data);
+		e_threads = calloc(threads, sizeof(pthread_t));
+		CHKALLOC(e_threads);
+		for (int i = 0; i < threads; i++)
+		{
+			e_data[i].sock = senders[i].state.sock;
+			e_data[i].sem = &e_sem;
+			e_data[i].dataout = dataout;
+			e_data[i].format = config->log_format;
+			e_data[i].id = i;
+			e_data[i].stats_interval = config->stats_interval;
+			e_data[i].server_stamps = config->server_stamps;
+			e_data[i].offset = malloc(sizeof(struct clock_offset));
+			CHKALLOC(e_data[i].offset);
+			clock_offset_init(e_data[i].offset);
+			e_data[i].echoes = calloc(1, sizeof(struct flow_stats));
+			CHKALLOC(e_data[i].echoes);
+			touch_page(e_data[i].echoes, sizeof(struct flow_stats));
+			atomic_init(&(e_data[i].answered), 0);
+			atomic_init(&(e_data[i].max_rtt), 0);
+			/* two histograms, total and interval */
+			e_data[i].rtt = calloc(2, sizeof(struct histogram));
+			CHKALLOC(e_data[i].rtt);
+			touch_page(e_data[i].rtt,
+				   2 * sizeof(struct histogram));
+			e_data[i].rtt_interval = e_data[i].rtt + 1;
+			if (config->sweep_min > 0)
+			{
+				e_data[i].rtt_step =
+					calloc(2, sizeof(struct histogram));
+				CHKALLOC(e_data[i].rtt_step);
+				touch_page(e_data[i].rtt_step,
+					   2 * sizeof(struct histogram));
+				for (int j = 0; j < 2; j++)
+				{
+					atomic_init(&(e_data[i].step_answered[j]),
+						    0);
+					atomic_init(&(e_data[i].step_first[j]),
+						    0);
+				}
+				/* no step yet, the first one gets index
+				 * 0 */
+				atomic_init(&(e_data[i].step), -1);
+			}
+			if (config->closed_loop > 0)
+			{
+				e_data[i].queue = echo_queue_create
+					(config->closed_loop
+					 * ECHO_QUEUE_FACTOR);
+				senders[i].state.queue = e_data[i].queue;
+			}
+			ret = pthread_create(&(e_threads[i]), &thread_attrs,
+					     &echo_thread, &(e_data[i]));
+			if (ret != 0) {
+				fprintf(stderr, "creating echo thread failed: "
+					"%s\n", strerror(ret));
+				exit(1);
+			}
+		}
+	}
+
+	/* prepare and start the transmit timestamp thread, if
+	 * requested */
+	pthread_t tx_thread;
+	struct txstamp_thread_data tx_data;
+	if (config->tx_timestamps != TXSTAMP_NONE)
+	{
+		tx_data.socks = calloc(threads, sizeof(int));
+		CHKALLOC(tx_data.socks);
+		for (int i = 0; i < threads; i++)
+		{
+			enable_tx_timestamps(senders[i].state.sock,
+					     config->tx_timestamps);
+			tx_data.socks[i] = senders[i].state.sock;
+		}
+		tx_data.nsocks = threads;
+		tx_data.logfile = config->tx_log;
+		tx_data.format = config->log_format;
+		if (sem_init(&(tx_data.sem), 0, 0) != 0)
+		{
+			perror("Initializing transmit timestamp semaphore");
+			exit(EXIT_MEMFAIL);
+		}
+		ret = pthread_create(&tx_thread, &thread_attrs,
+				     &txstamp_thread, &tx_data);
 		if (ret != 0) {
-			fprintf(stderr, "creating echo thread failed: %s\n",
-				strerror(ret));
+			fprintf(stderr, "creating transmit timestamp thread "
+				"failed: %s\n", strerror(ret));
 			exit(1);
 		}
 	}
-	pthread_attr_destroy(&thread_attrs);
 
-	/* current sequence number */
-	int seq = 0;
-	/* sequence number in the LUNA packet */
-	int *const sequence = (int *) buf;
-	/* time right before sending in the LUNA packet */
-	struct timespec *const sendtime =
-		(struct timespec *) (buf + sizeof(int));
-	/* protocol flags field */
-	char *const flags =
-		(char *) (buf + sizeof(int) + sizeof(struct timespec));
-	*flags = 0;
-	if (echo)
-		*flags = *flags | LUNA_FLAG_ECHO;
-	/* index in the current block */
-	int bi = 0;
-
-	sem_wait(&ready_sem);
-	if (echo)
-		sem_wait(&(e_data->sem));
-	struct packet_block *block = generator.block;
-	pthread_mutex_lock(block->lock);
-
-	/* timespecs for the timer */
-	struct timespec nexttick = {0, 0};
-	struct timespec rem = {0, 0};
-	struct timespec now = {0, 0};
+	if (config->echo)
+		for (int i = 0; i < threads; i++)
+			sem_wait(&e_sem);
+	if (config->tx_timestamps != TXSTAMP_NONE)
+		sem_wait(&(tx_data.sem));
 
-	/* if start_time is zeroed, just use "now" */
-	if (start_time.tv_sec == 0 && start_time.tv_nsec == 0)
-		clock_gettime(clk_id, &nexttick);
-	/* otherwise initialize nexttick to start_time */
+	if (config->sweep_min > 0)
+		run_sweep(senders, e_data, config, &thread_attrs,
+			  &barrier, &start);
 	else
 	{
-		nexttick.tv_sec = start_time.tv_sec;
-		nexttick.tv_nsec = start_time.tv_nsec;
+		start_generators(senders, config, &thread_attrs, 0);
+		run_senders(senders, config, &thread_attrs, &barrier, &start);
 	}
-	const struct timespec end = {nexttick.tv_sec + time, nexttick.tv_nsec};
-
-	/* Store page fault statistics to check if memory management
-	 * is working properly */
-	struct rusage usage_pre;
-	struct rusage usage_post;
-	getrusage(RUSAGE_SELF, &usage_pre);
-	while (now.tv_sec < end.tv_sec || now.tv_nsec < end.tv_nsec)
+	pthread_attr_destroy(&thread_attrs);
+	pthread_barrier_destroy(&barrier);
+
+	if (config->echo)
 	{
-		*sequence = htonl(seq++);
-		timespecadd(&nexttick, &(block->data[bi].delay), &nexttick);
-		/* sleep until scheduled send time */
-		clock_nanosleep(clk_id, TIMER_ABSTIME,
-				&nexttick, &rem); // TODO: error check
-		/* record current time into the packet */
-		clock_gettime(CLOCK_REALTIME, sendtime);
-		/* send the packet */
-		if (send(sock, buf, block->data[bi].size, 0) == -1)
-			perror("Error while sending");
-
-		/* switch buffer block if necessary */
-		if (++bi == block->length)
+		/* echoes may still be queued for sending in txtime
+		 * mode */
+		drain_echoes(senders, e_data, threads,
+			     config->send_mode == SEND_MODE_TXTIME ?
+			     config->lead_time : 0);
+		for (int i = 0; i < threads; i++)
+			pthread_cancel(e_threads[i]);
+		/* wait for echo handler threads to terminate and free
+		 * associated data */
+		for (int i = 0; i < threads; i++)
+			pthread_join(e_threads[i], NULL);
+		for (int i = 0; i < threads; i++)
 		{
-			bi = 0;
-			pthread_mutex_unlock(block->lock);
-			block = block->next;
-			if (pthread_mutex_trylock(block->lock) != 0)
+			char name[32];
+			snprintf(name, sizeof(name), "Sender %i RTT", i);
+			report_echoes(stderr, i, senders[i].state.seq,
+				      e_data[i].echoes);
+			histogram_report(stderr, name, e_data[i].rtt);
+			free(e_data[i].rtt);
+			free(e_data[i].rtt_step);
+			free(e_data[i].echoes);
+			if (config->server_stamps)
+			{
+				snprintf(name, sizeof(name),
+					 "Sender %i clock", i);
+				clock_offset_report(stderr, name,
+						    e_data[i].offset);
+			}
+			free(e_data[i].offset);
+			if (e_data[i].queue != NULL)
 			{
-				fprintf(stderr, "ERROR: Could not get lock for "
-					"the next send parameter block!\nMake "
-					"sure your data generator is fast "
-					"enough and unlocks mutexes "
-					"properly.\n");
-				break;
+				if (e_data[i].queue->dropped > 0)
+					fprintf(stderr, "Sender %i: %ld echoes "
+						"dropped from full echo "
+						"queue.\n", i,
+						e_data[i].queue->dropped);
+				echo_queue_destroy(e_data[i].queue);
 			}
-			sem_post(&semaphore);
 		}
-		/* get the current time, needed to stop the loop at
-		 * the right time */
-		clock_gettime(clk_id, &now);
+		sem_destroy(&e_sem);
+		free(e_threads);
+		free(e_data);
+		if (dataout != stdout && fclose(dataout))
+		{
+			perror("Closing echo output file");
+			exit(EXIT_FILEFAIL);
+		}
 	}
 
-	/* Check page fault statistics to see if memory management is
-	 * working properly */
-	getrusage(RUSAGE_SELF, &usage_post);
-	if (check_pfaults(&usage_pre, &usage_post))
-		fprintf(stderr,
-			"WARNING: Page faults occurred in real-time section!\n"
-			"Pre:  Major-pagefaults: %ld, Minor Pagefaults: %ld\n"
-			"Post: Major-pagefaults: %ld, Minor Pagefaults: %ld\n",
-			usage_pre.ru_majflt, usage_pre.ru_minflt,
-			usage_post.ru_majflt, usage_post.ru_minflt);
-
-	pthread_mutex_unlock(block->lock);
-	pthread_cancel(gen_thread);
-
-	/* send buffer isn't needed any more */
-	free(buf);
-
-	/* free up generator resources after it has terminated */
-	pthread_join(gen_thread, NULL);
-	generator.destroy_generator(&generator);
-	sem_destroy(&semaphore);
-	sem_destroy(&ready_sem);
-
-	if (echo)
+	if (config->tx_timestamps != TXSTAMP_NONE)
 	{
-		// TODO: appropriate delay to wait for echos
-		pthread_cancel(e_thread);
-		/* wait for echo handler thread to terminate and free
-		 * associated data */
-		pthread_join(e_thread, NULL);
-		sem_destroy(&(e_data->sem));
-		free(e_data);
+		/* give the kernel a moment to report the last
+		 * timestamps */
+		const struct timespec wait = {0, TXSTAMP_DRAIN_TIME};
+		clock_nanosleep(CLOCK_MONOTONIC, 0, &wait, NULL);
+		pthread_cancel(tx_thread);
+		pthread_join(tx_thread, NULL);
+		sem_destroy(&(tx_data.sem));
+		free(tx_data.socks);
 	}
 
-	/* close socket after echo thread has terminated */
-	close(sock);
+	/* close sockets after echo threads have terminated */
+	for (int i = 0; i < threads; i++)
+		close(senders[i].state.sock);
+	free(senders);
 	return 0;
 }
 
@@ -290,7 +816,7 @@ int run_client(struct addrinfo *addr, const int time,
 void* echo_thread(void *arg)
 {
 	struct echo_thread_data *data = (struct echo_thread_data *) arg;
-	int sock = data->sock;
+	const int sock = data->sock;
 
 	/* Processing echo packets is less urgent than sending or
 	 * generation, because the kernel buffers them. Reduce
@@ -315,92 +841,213 @@ void* echo_thread(void *arg)
 	/* ensure free() on cancellation */
 	pthread_cleanup_push(&free, buf);
 	ssize_t recvlen = 0;
-	int seq = 0;
+	struct packet_header hdr;
 	struct sockaddr *const addrbuf = malloc(ADDRBUF_SIZE);
 	CHKALLOC(addrbuf);
 	touch_page(addrbuf, ADDRBUF_SIZE);
 	pthread_cleanup_push(&free, addrbuf);
-	socklen_t addrlen = 0;
+	char *const cbuf = malloc(RECV_CMSG_SIZE);
+	CHKALLOC(cbuf);
+	touch_page(cbuf, RECV_CMSG_SIZE);
+	pthread_cleanup_push(&free, cbuf);
+	struct iovec iov = {buf, buflen};
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = addrbuf;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	/* Receive timestamps are delivered as control messages. The
+	 * SIOCGSTAMPNS ioctl would not work if transmit timestamps
+	 * are enabled on the socket. */
+	const int tsopt = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS,
+		       &tsopt, sizeof(tsopt)) != 0)
+	{
+		perror("setsockopt SO_TIMESTAMPNS");
+		exit(EXIT_NETFAIL);
+	}
 	/* timestamp related data */
-	struct timespec *const sendtime =
-		(struct timespec *) (buf + sizeof(int));
-	struct timeval recvtime = {0, 0};
-	struct timeval rtt = {0, 0};
+	struct timespec recvtime = {0, 0};
+	int64_t rtt = 0;
+	/* server receive and send time (ns), if requested */
+	int64_t server_rx = 0;
+	int64_t server_tx = 0;
+	/* time of the next RTT report (monotonic clock) */
+	struct timespec now;
+	struct timespec next_report;
+	const struct timespec report_interval = {data->stats_interval, 0};
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecadd(&now, &report_interval, &next_report);
+	char report_name[32];
+	snprintf(report_name, sizeof(report_name), "Sender %i RTT interval",
+		 data->id);
+	char offset_name[32];
+	snprintf(offset_name, sizeof(offset_name), "Sender %i clock",
+		 data->id);
 
 	/* prepare time to text conversion */
 	tzset();
 	struct tm tm;
-	localtime_r(&(rtt.tv_sec), &tm);
+	localtime_r(&(recvtime.tv_sec), &tm);
 	char *const timestr = calloc(T_TIME_BUF, sizeof(char));
 	CHKALLOC(timestr);
 	touch_page(timestr, T_TIME_BUF);
 	pthread_cleanup_push(&free, timestr);
 
-	/* Open output file if specified */
-	FILE *dataout = stdout;
-	if (data->datafile != NULL)
-	{
-		dataout = fopen(data->datafile, "w");
-		if (dataout == NULL)
-		{
-			perror("Opening output file in echo_thread");
-			exit(EXIT_FILEFAIL);
-		}
-	}
-	pthread_cleanup_push(&_fclose_wrapper, dataout);
-
+	FILE *const dataout = data->dataout;
 	int work = 1;
-	fprintf(dataout, "# ktime\tsequence\tsize\trtt\n");
 	/* init done */
-	sem_post(&(data->sem));
+	sem_post(data->sem);
 
 	while (work)
 	{
-		addrlen = ADDRBUF_SIZE;
-		/* recvfrom() is a cancellation point according to
+		msg.msg_namelen = ADDRBUF_SIZE;
+		msg.msg_controllen = RECV_CMSG_SIZE;
+		/* recvmsg() is a cancellation point according to
 		 * POSIX, so handling the -1 return case is not
 		 * necessary here. */
-		recvlen = recvfrom(sock, buf, buflen, 0, addrbuf, &addrlen);
+		recvlen = recvmsg(sock, &msg, 0);
 		/* get kernel timestamp */
-		ioctl(sock, SIOCGSTAMP, &recvtime); // TODO: error check
+		if (packet_timestamp(&msg, &recvtime) != 0)
+			fprintf(stderr, "recv: no kernel timestamp "
+				"for packet!\n");
 
-		if (addrlen > ADDRBUF_SIZE)
+		if (msg.msg_namelen > ADDRBUF_SIZE)
 			fprintf(stderr, "recv: addr buffer too small!\n");
 
 		/* This really should not happen, but we're dealing
 		 * with an open network socket, so who knows what
 		 * might arrive there... */
-		if (recvlen < MIN_PACKET_SIZE)
+		if (packet_read_header(buf, recvlen, &hdr) != 0)
 		{
 			fprintf(stderr, "Only %ld bytes received, smaller than "
 				"minimum protocol size! Ignoring packet.\n",
 				recvlen);
 			continue;
 		}
-
-		seq = ntohl(*((int *) buf));
+		/* late replies to protocol negotiation */
+		if (hdr.flags & LUNA_FLAG_HELLO)
+			continue;
+		const int64_t seq = hdr.sequence;
+		/* closed-loop mode: let the sender know as early as
+		 * possible */
+		if (data->queue != NULL)
+			echo_queue_push(data->queue, seq);
 
 		/* Calculate RTT */
-		rtt.tv_sec = recvtime.tv_sec - sendtime->tv_sec;
-		rtt.tv_usec =
-			recvtime.tv_usec - (sendtime->tv_nsec / NS_PER_US);
-		if (rtt.tv_usec < 0)
+		rtt = timespec_to_ns(&recvtime) - hdr.send_time;
+		histogram_record(data->rtt, rtt);
+		const int64_t duplicates = data->echoes->c.duplicates;
+		flow_stats_update(data->echoes, seq, timespec_to_ns(&recvtime),
+				  hdr.send_time);
+		atomic_store(&(data->answered), data->echoes->c.received
+			     - data->echoes->c.duplicates);
+		if (data->rtt_step != NULL)
+		{
+			const int slot = atomic_load(&(data->step)) & 1;
+			if (seq >= atomic_load(&(data->step_first[slot])))
+			{
+				histogram_record(&(data->rtt_step[slot]), rtt);
+				if (data->echoes->c.duplicates == duplicates)
+					atomic_fetch_add(&(data->step_answered
+							   [slot]), 1);
+			}
+		}
+		if (rtt > atomic_load(&(data->max_rtt)))
+			atomic_store(&(data->max_rtt), rtt);
+		if (data->stats_interval > 0)
+		{
+			histogram_record(data->rtt_interval, rtt);
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (timespec_to_ns(&now) >= timespec_to_ns(&next_report))
+			{
+				histogram_report(stderr, report_name,
+						 data->rtt_interval);
+				histogram_reset(data->rtt_interval);
+				if (data->server_stamps)
+					clock_offset_report(stderr,
+							    offset_name,
+							    data->offset);
+				timespecadd(&now, &report_interval,
+					    &next_report);
+			}
+		}
+
+		/* Server timestamps are missing if the packet was too
+		 * short to carry them. */
+		const int stamped = data->server_stamps
+			&& recvlen >= packet_stamped_size(&hdr);
+		if (stamped)
+		{
+			server_rx = packet_read_stamp(buf, &hdr, 0);
+			server_tx = packet_read_stamp(buf, &hdr, 1);
+			clock_offset_sample(data->offset, hdr.send_time,
+					    server_rx, server_tx,
+					    timespec_to_ns(&recvtime));
+		}
+
+		/* The output is shared with the echo threads of the
+		 * other senders, each record or line is written with
+		 * a single call to keep them intact. */
+		if (data->format == LOG_FORMAT_BINARY)
 		{
-			rtt.tv_usec += US_PER_S;
-			rtt.tv_sec -= 1;
+			if (stamped)
+				binlog_write_stamped_packet(
+					dataout, data->id,
+					hdr.flags, &recvtime, rtt, seq,
+					recvlen, server_rx, server_tx);
+			else
+				binlog_write_packet(dataout, data->id,
+						    hdr.flags,
+						    &recvtime, rtt, seq,
+						    recvlen);
+			continue;
 		}
 
 		/* Process arrival time */
 		localtime_r(&(recvtime.tv_sec), &tm);
 		strftime(timestr, T_TIME_BUF, "%s", &tm);
 
-		/* Write packet information */
-		fprintf(dataout, "%s%06ld\t%i\t%ld\t",
-			timestr, recvtime.tv_usec, seq, recvlen);
-		if (rtt.tv_sec > 0)
-			fprintf(dataout, "%ld%06ld\n", rtt.tv_sec, rtt.tv_usec);
+		/* Write packet information, times in microseconds
+		 * with the nanoseconds as decimal places */
+		if (!data->server_stamps)
+			fprintf(dataout, "%s%06ld.%03ld\t%" PRId64 "\t%ld\t"
+				"%ld.%03ld\n",
+				timestr, recvtime.tv_nsec / NS_PER_US,
+				recvtime.tv_nsec % NS_PER_US, seq, recvlen,
+				(long) (rtt / NS_PER_US),
+				(long) (rtt % NS_PER_US));
+		else if (!stamped)
+			fprintf(dataout, "%s%06ld.%03ld\t%" PRId64 "\t%ld\t"
+				"%ld.%03ld\tNaN\tNaN\tNaN\tNaN\n",
+				timestr, recvtime.tv_nsec / NS_PER_US,
+				recvtime.tv_nsec % NS_PER_US, seq, recvlen,
+				(long) (rtt / NS_PER_US),
+				(long) (rtt % NS_PER_US));
 		else
-			fprintf(dataout, "%ld\n", rtt.tv_usec);
+		{
+			/* The one-way delays include the offset
+			 * between the clocks of client and server,
+			 * which is estimated from the timestamps
+			 * received so far. */
+			const int64_t forward = server_rx - hdr.send_time;
+			const int64_t reverse = timespec_to_ns(&recvtime)
+				- server_tx;
+			const int64_t residence = server_tx - server_rx;
+			const int64_t offset = clock_offset_at(data->offset,
+							       hdr.send_time);
+			fprintf(dataout, "%s%06ld.%03ld\t%" PRId64 "\t%ld\t"
+				"%ld.%03ld\t%.3f\t%.3f\t%.3f\t%.3f\n",
+				timestr, recvtime.tv_nsec / NS_PER_US,
+				recvtime.tv_nsec % NS_PER_US, seq, recvlen,
+				(long) (rtt / NS_PER_US),
+				(long) (rtt % NS_PER_US),
+				(double) forward / NS_PER_US,
+				(double) reverse / NS_PER_US,
+				(double) residence / NS_PER_US,
+				(double) offset / NS_PER_US);
+		}
 	}
 
 	/* The function should never reach this point because it will
@@ -414,22 +1061,3 @@ void* echo_thread(void *arg)
 	pthread_cleanup_pop(1);
 	return NULL;
 }
-
-
-
-/* This wrapper is needed because fclose does not match the signature
- * required for pthread_cleanup_push(). If an error occurs, an error
- * message is written, but no further action taken. Since this
- * function is only called when the process is about to exit, this
- * should be safe. */
-void _fclose_wrapper(void *arg)
-{
-	if (arg == stdout)
-		return;
-
-	if (fclose((FILE *) arg))
-	{
-		perror("Closing output file on echo_thread termination");
-		exit(EXIT_FILEFAIL);
-	}
-}
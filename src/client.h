@@ -19,23 +19,122 @@
 #ifndef __LUNA_CLIENT_H__
 #define __LUNA_CLIENT_H__
 
+#include <netdb.h>
 #include <netinet/in.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "luna.h"
+
+/* Send modes: how the client times the transmission of packets */
+/* sleep until each packet is due, then send it */
+#define SEND_MODE_SLEEP 0
+/* hand packets to the kernel in batches ahead of time, and let the
+ * qdisc send them at their scheduled time (SO_TXTIME) */
+#define SEND_MODE_TXTIME 1
+/* sleep until shortly before each packet is due, then busy-wait for
+ * the exact send time */
+#define SEND_MODE_SPIN 2
+
+/* default number of packets per sendmmsg() call in txtime mode */
+#define DEFAULT_TXTIME_BATCH 32
+/* default lead time for txtime mode (ns) */
+#define DEFAULT_TXTIME_LEAD (500 * NS_PER_US)
+/* default time to wait for the echo of a request in closed-loop
+ * mode (ns) */
+#define DEFAULT_REQUEST_TIMEOUT ((long) NS_PER_S)
+/* default echo loss a rate sweep step may have (percent) */
+#define DEFAULT_SLO_LOSS 0.1
+/* default amount of schedule the generators buffer (ns), see
+ * create_sized_block_circle() in generator.h */
+#define DEFAULT_BUFFER_TIME (50 * 1000 * (int64_t) NS_PER_US)
 
 /*
- * addr: destination (IP address, port)
+ * Settings for run_client:
+ *
  * time: time (in seconds) to send packets
  * start_time: time when the client should start sending
  * clk_id: Clock to use for packet timing, start_time is compared to
  *	   this clock. See time.h for available clocks.
  * echo: request echo packets?
+ * server_stamps: request server receive and send timestamps in echo
+ *		  packets?
  * generator_type: name of the generator to use
  * generator_args: parameters for the generator
+ * datafile: file to write echo data to, or NULL for stdout
+ * send_mode: one of the SEND_MODE_* constants
+ * batch: maximum number of packets per sendmmsg() call (txtime mode)
+ * lead_time: how long before the first packet of a batch is due the
+ *	      batch is handed to the kernel (ns, txtime mode)
+ * threads: number of sending threads. Each one sends its share of
+ *	    the generator's schedule over its own socket.
+ * underrun: what senders do if the generator is too slow, one of
+ *	     the UNDERRUN_* constants in traffic.h
+ * tx_timestamps: transmit timestamp mode, one of the TXSTAMP_*
+ *		  constants in txstamp.h
+ * tx_log: file to write transmit timestamps to
+ * protocol: protocol version to use, PROTOCOL_AUTO to negotiate (see
+ *	     protocol.h)
+ * log_format: format of echo and transmit timestamp logs, one of the
+ *	       LOG_FORMAT_* constants in binlog.h
+ * spin_margin: how long before a packet is due the client stops
+ *		sleeping and starts busy-waiting (ns, spin mode). 0
+ *		means calibrate automatically.
+ * stats_interval: interval for RTT quantile reports on stderr (s),
+ *		   0 for a summary at the end only
+ * closed_loop: number of outstanding requests per sender in
+ *		closed-loop mode, 0 for open-loop sending
+ * request_timeout: how long a closed-loop request slot waits for an
+ *		    echo before it sends the next request (ns)
+ * sweep_min, sweep_max, sweep_step: rate sweep from sweep_min to
+ *				     sweep_max packets/s, in steps of
+ *				     sweep_step or by binary search if
+ *				     sweep_step is 0 (see sweep.h).
+ *				     sweep_min is 0 without sweep. Each
+ *				     step lasts "time" seconds.
+ * slo_loss: highest echo loss (percent) a sweep step may have
+ * slo_rtt: highest 99th percentile RTT (ns) a sweep step may have, 0
+ *	    for no limit
+ * hugepages: allocate the generators' packet blocks on huge pages
+ * buffer_time: amount of schedule generators buffer ahead of the
+ *		senders (ns)
+ */
+struct client_config
+{
+	int time;
+	struct timespec start_time;
+	clockid_t clk_id;
+	int echo;
+	int server_stamps;
+	const char *generator_type;
+	const char *generator_args;
+	const char *datafile;
+	int send_mode;
+	int threads;
+	int underrun;
+	int batch;
+	long lead_time;
+	long spin_margin;
+	int tx_timestamps;
+	const char *tx_log;
+	int protocol;
+	int log_format;
+	int stats_interval;
+	int closed_loop;
+	long request_timeout;
+	double sweep_min;
+	double sweep_max;
+	double sweep_step;
+	double slo_loss;
+	int64_t slo_rtt;
+	int hugepages;
+	int64_t buffer_time;
+};
+
+/*
+ * addr: destination (IP address, port)
+ * config: client settings, see above
  */
-int run_client(struct addrinfo *addr, const int time,
-	       const struct timespec start_time, const clockid_t clk_id,
-	       const int echo,
-	       const char *const generator_type,
-	       const char *const generator_args,
-	       const char *const datafile);
+int run_client(struct addrinfo *addr, const struct client_config *const config);
 
 #endif /* __LUNA_CLIENT_H__ */
@@ -0,0 +1,127 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "clockoffset.h"
+#include "luna.h"
+
+
+
+void clock_offset_init(struct clock_offset *const est)
+{
+	memset(est, 0, sizeof(struct clock_offset));
+}
+
+
+
+/* Add the best sample of a window to the least squares line and
+ * update the estimate */
+static void add_window(struct clock_offset *const est)
+{
+	const double t = (double) (est->window_time - est->start);
+	const double o = (double) est->window_offset;
+	est->windows++;
+	est->sum_t += t;
+	est->sum_o += o;
+	est->sum_tt += t * t;
+	est->sum_to += t * o;
+
+	const double n = (double) est->windows;
+	const double var = n * est->sum_tt - est->sum_t * est->sum_t;
+	if (est->windows < 2 || var <= 0.0)
+	{
+		est->base = t;
+		est->offset = o;
+		est->skew = 0.0;
+		return;
+	}
+	est->skew = (n * est->sum_to - est->sum_t * est->sum_o) / var;
+	est->base = est->sum_t / n;
+	est->offset = est->sum_o / n;
+}
+
+
+
+void clock_offset_sample(struct clock_offset *const est,
+			 const int64_t client_tx, const int64_t server_rx,
+			 const int64_t server_tx, const int64_t client_rx)
+{
+	const int64_t delay = (client_rx - client_tx) - (server_tx - server_rx);
+	const int64_t offset = ((server_rx - client_tx)
+				+ (server_tx - client_rx)) / 2;
+	if (est->samples++ == 0)
+	{
+		est->start = client_tx;
+		est->min_delay = delay;
+	}
+	else if (delay < est->min_delay)
+		est->min_delay = delay;
+
+	if (est->window_count == 0 || delay < est->window_delay)
+	{
+		est->window_delay = delay;
+		est->window_offset = offset;
+		est->window_time = client_tx;
+	}
+	/* until the first window is complete, its best sample so far
+	 * is the estimate */
+	if (est->windows == 0)
+	{
+		est->base = (double) (est->window_time - est->start);
+		est->offset = (double) est->window_offset;
+	}
+	if (++(est->window_count) == CLOCK_OFFSET_WINDOW)
+	{
+		add_window(est);
+		est->window_count = 0;
+	}
+}
+
+
+
+int64_t clock_offset_at(const struct clock_offset *const est,
+			const int64_t time)
+{
+	if (est->samples == 0)
+		return 0;
+	const double t = (double) (time - est->start);
+	return (int64_t) (est->offset + est->skew * (t - est->base));
+}
+
+
+
+void clock_offset_report(FILE *const out, const char *const name,
+			 const struct clock_offset *const est)
+{
+	if (est->samples == 0)
+	{
+		fprintf(out, "%s: no echoes with server timestamps\n", name);
+		return;
+	}
+	/* offset at the time of the last window sample */
+	const int64_t offset = clock_offset_at(est, est->window_time);
+	fprintf(out, "%s: offset %.3fµs, skew %.3fppm, minimum delay "
+		"%.3fµs (%" PRId64 " echoes, %" PRId64 " windows)\n",
+		name, (double) offset / NS_PER_US, est->skew * 1e6,
+		(double) est->min_delay / NS_PER_US, est->samples,
+		est->windows);
+}
@@ -0,0 +1,92 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_CLOCKOFFSET_H__
+#define __LUNA_CLOCKOFFSET_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* number of echoes per window, only the one with the smallest round
+ * trip delay of each window is used */
+#define CLOCK_OFFSET_WINDOW 32
+
+/*
+ * Estimate the offset of the server clock relative to the client
+ * clock from the four timestamps of echoes with server timestamps
+ * (client send, server receive, server send, client receive), the
+ * way NTP does:
+ *
+ * offset = ((server receive - client send)
+ *	     + (server send - client receive)) / 2
+ * delay = (client receive - client send) - (server send - server receive)
+ *
+ * The offset is exact if forward and reverse delay are equal, queueing
+ * on either path adds half its delay as error. To filter that, each
+ * window of CLOCK_OFFSET_WINDOW echoes contributes only its sample
+ * with the smallest delay. The skew (drift rate) of the clocks is the
+ * slope of a least squares line through the window samples over the
+ * client send time, updated in constant time per window.
+ */
+struct clock_offset
+{
+	/* client send time of the first sample, times in the least
+	 * squares sums are relative to it to keep precision (ns) */
+	int64_t start;
+	/* number of samples */
+	int64_t samples;
+	/* best sample of the current window */
+	int window_count;
+	int64_t window_delay;
+	int64_t window_offset;
+	int64_t window_time;
+	/* smallest delay seen (ns) */
+	int64_t min_delay;
+	/* least squares sums over the window samples */
+	int64_t windows;
+	double sum_t;
+	double sum_o;
+	double sum_tt;
+	double sum_to;
+	/* current estimate: offset (ns) at the time "base" (ns,
+	 * relative to start), and skew */
+	double base;
+	double offset;
+	double skew;
+};
+
+/* Reset the estimator */
+void clock_offset_init(struct clock_offset *const est);
+
+/* Add the timestamps of one echo (ns): client send time, server
+ * receive time, server send time and client receive time */
+void clock_offset_sample(struct clock_offset *const est,
+			 const int64_t client_tx, const int64_t server_rx,
+			 const int64_t server_tx, const int64_t client_rx);
+
+/* Estimated offset of the server clock (ns) at the given client
+ * time, 0 if there are no samples yet */
+int64_t clock_offset_at(const struct clock_offset *const est,
+			const int64_t time);
+
+/* Write the current offset, skew and sample count to out, as one
+ * line starting with the given name */
+void clock_offset_report(FILE *const out, const char *const name,
+			 const struct clock_offset *const est);
+
+#endif /* __LUNA_CLOCKOFFSET_H__ */
@@ -0,0 +1,158 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "distribution.h"
+
+/* Names of the distribution types, indexed by DIST_* constant, and
+ * the number of parameters of each */
+static const char *const dist_names[] = {
+	"constant", "uniform", "exponential", "pareto", "lognormal", "weibull"
+};
+static const int dist_params[] = {1, 2, 1, 2, 2, 2};
+#define DIST_TYPES ((int) (sizeof(dist_params) / sizeof(dist_params[0])))
+
+
+
+int distribution_parse(const char *const spec, struct distribution *dist)
+{
+	if (spec == NULL)
+		return -1;
+	const char *const colon = strchr(spec, ':');
+	const size_t len = colon == NULL ?
+		strlen(spec) : (size_t) (colon - spec);
+	int type = -1;
+	for (int i = 0; i < DIST_TYPES; i++)
+		if (strlen(dist_names[i]) == len
+		    && strncmp(spec, dist_names[i], len) == 0)
+			type = i;
+	if (type < 0 || colon == NULL)
+		return -1;
+
+	char *end = NULL;
+	dist->type = type;
+	dist->a = strtod(colon + 1, &end);
+	dist->b = 0;
+	if (end == colon + 1)
+		return -1;
+	if (dist_params[type] == 2)
+	{
+		if (*end != ':')
+			return -1;
+		const char *const p = end + 1;
+		dist->b = strtod(p, &end);
+		if (end == p)
+			return -1;
+	}
+	if (*end != '\0')
+		return -1;
+
+	/* reject parameters the distribution is not defined for */
+	switch (type)
+	{
+	case DIST_CONSTANT:
+		return dist->a >= 0 ? 0 : -1;
+	case DIST_UNIFORM:
+		return dist->a >= 0 && dist->b >= dist->a ? 0 : -1;
+	case DIST_LOGNORMAL:
+		return dist->b > 0 ? 0 : -1;
+	default:
+		return dist->a > 0 && (dist_params[type] == 1 || dist->b > 0) ?
+			0 : -1;
+	}
+}
+
+
+
+void distribution_sample_batch(const struct distribution *const dist,
+			       struct rng *const rng, double *out,
+			       const int n)
+{
+	const double a = dist->a;
+	const double b = dist->b;
+	switch (dist->type)
+	{
+	case DIST_UNIFORM:
+		rng_uniform(rng, out, n);
+		for (int i = 0; i < n; i++)
+			out[i] = a + (b - a) * out[i];
+		break;
+	case DIST_EXPONENTIAL:
+		rng_exponential(rng, out, n);
+		for (int i = 0; i < n; i++)
+			out[i] *= a;
+		break;
+	case DIST_PARETO:
+		rng_uniform(rng, out, n);
+		for (int i = 0; i < n; i++)
+			out[i] = b * pow(out[i], -1.0 / a);
+		break;
+	case DIST_LOGNORMAL:
+		rng_gaussian(rng, out, n);
+		for (int i = 0; i < n; i++)
+			out[i] = exp(a + b * out[i]);
+		break;
+	case DIST_WEIBULL:
+		rng_exponential(rng, out, n);
+		for (int i = 0; i < n; i++)
+			out[i] = a * pow(out[i], 1.0 / b);
+		break;
+	default:
+		for (int i = 0; i < n; i++)
+			out[i] = a;
+	}
+}
+
+
+
+double distribution_bound(const struct distribution *const dist,
+			  const double limit)
+{
+	double bound = limit;
+	if (dist->type == DIST_CONSTANT)
+		bound = dist->a;
+	else if (dist->type == DIST_UNIFORM)
+		bound = dist->b;
+	return bound < limit ? bound : limit;
+}
+
+
+
+double distribution_mean(const struct distribution *const dist)
+{
+	switch (dist->type)
+	{
+	case DIST_UNIFORM:
+		return (dist->a + dist->b) / 2;
+	case DIST_EXPONENTIAL:
+		return dist->a;
+	case DIST_PARETO:
+		return dist->a > 1 ? dist->a * dist->b / (dist->a - 1) : -1;
+	case DIST_LOGNORMAL:
+		return exp(dist->a + dist->b * dist->b / 2);
+	case DIST_WEIBULL:
+		return dist->a * tgamma(1 + 1 / dist->b);
+	default:
+		return dist->a;
+	}
+}
@@ -0,0 +1,72 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_DISTRIBUTION_H__
+#define __LUNA_DISTRIBUTION_H__
+
+#include "rng.h"
+
+/* Distribution types */
+#define DIST_CONSTANT 0
+#define DIST_UNIFORM 1
+#define DIST_EXPONENTIAL 2
+#define DIST_PARETO 3
+#define DIST_LOGNORMAL 4
+#define DIST_WEIBULL 5
+
+/*
+ * A probability distribution with up to two parameters, parsed from
+ * a string "NAME:P1[:P2]":
+ *
+ * constant:VALUE
+ * uniform:MIN:MAX
+ * exponential:MEAN
+ * pareto:SHAPE:SCALE (SCALE is the minimum value)
+ * lognormal:ZETA:SIGMA (the logarithm of the values has mean ZETA and
+ *			standard deviation SIGMA)
+ * weibull:SCALE:SHAPE
+ *
+ * Samples are drawn by transforming the output of the batch random
+ * number generator (see rng.h).
+ */
+struct distribution
+{
+	int type;
+	double a;
+	double b;
+};
+
+/* Parse spec into *dist. Returns 0 on success, -1 if spec is
+ * invalid. */
+int distribution_parse(const char *const spec, struct distribution *dist);
+
+/* Fill out with n values drawn from the distribution */
+void distribution_sample_batch(const struct distribution *const dist,
+			       struct rng *const rng, double *out,
+			       const int n);
+
+/* Upper bound of the values of the distribution, or limit if it has
+ * none below limit */
+double distribution_bound(const struct distribution *const dist,
+			  const double limit);
+
+/* Mean of the distribution, or a negative value if it is
+ * infinite */
+double distribution_mean(const struct distribution *const dist);
+
+#endif /* __LUNA_DISTRIBUTION_H__ */
@@ -0,0 +1,213 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "luna.h"
+#include "distribution.h"
+#include "distribution_generator.h"
+#include "rng.h"
+
+/* default maximum packet size if the size distribution has no upper
+ * bound (bytes) */
+#define DEFAULT_MAX_SIZE MSG_BUF_SIZE
+
+int distribution_generator_init(generator_t *this);
+int distribution_generator_fill_block(generator_t *this,
+				      struct packet_block *current);
+int distribution_generator_destroy(generator_t *this);
+
+struct distribution_generator_attr
+{
+	/* packet interval (µs) and size (bytes) */
+	struct distribution interval;
+	struct distribution size;
+	struct rng rng;
+	/* random values for one block */
+	double *values;
+};
+
+
+
+/* Parse the distribution for the named argument, exits if it is
+ * invalid */
+static void parse_arg(const char *const name, const char *const value,
+		      struct distribution *const dist)
+{
+	if (distribution_parse(value, dist) != 0)
+	{
+		fprintf(stderr, "ERROR: Invalid distribution for %s: "
+			"\"%s\"!\n", name, value);
+		exit(EXIT_INVALID);
+	}
+}
+
+
+
+/*
+ * Create the generator. The parameters are taken from args. If args
+ * is NULL, or a parameter is missing, default values will be used.
+ *
+ * interval (i): distribution of the time between two packets (µs),
+ *		 default constant:1000
+ * size (s): distribution of the packet size (bytes), default the
+ *	     minimum size
+ * max (m): maximum packet size, larger values are replaced with it.
+ *	    Defaults to the upper bound of the size distribution, or
+ *	    DEFAULT_MAX_SIZE if it has none.
+ * seed: seed for the random number generator, default
+ *	 RNG_DEFAULT_SEED
+ */
+int distribution_generator_create(generator_t *this, generator_option *args)
+{
+	this->init_generator = &distribution_generator_init;
+	this->fill_block = &distribution_generator_fill_block;
+	this->destroy_generator = &distribution_generator_destroy;
+
+	this->attr = malloc(sizeof(struct distribution_generator_attr));
+	CHKALLOC(this->attr);
+	struct distribution_generator_attr *attr =
+		(struct distribution_generator_attr *) this->attr;
+	const struct distribution interval = {DIST_CONSTANT, 1000, 0};
+	const struct distribution size = {DIST_CONSTANT, MIN_PACKET_SIZE, 0};
+	attr->interval = interval;
+	attr->size = size;
+	int max = 0;
+	unsigned long seed = RNG_DEFAULT_SEED;
+
+	if (args != NULL)
+	{
+		for (int i = 0; args[i].name != NULL; i++)
+		{
+			char *name = args[i].name;
+			char *value = args[i].value;
+			if (strcmp(name, "interval") == 0
+			    || strcmp(name, "i") == 0)
+				parse_arg("interval", value,
+					  &(attr->interval));
+			else if (strcmp(name, "size") == 0
+				 || strcmp(name, "s") == 0)
+				parse_arg("size", value, &(attr->size));
+			else if (strcmp(name, "max") == 0
+				 || strcmp(name, "m") == 0)
+				max = atoi(value);
+			else if (strcmp(name, "seed") == 0)
+				seed = strtoul(value, NULL, 10);
+			else
+			{
+				fprintf(stderr, "ERROR: Unknown argument "
+					"\"%s\" for the distribution "
+					"generator!\n", name);
+				exit(EXIT_INVALID);
+			}
+		}
+	}
+
+	if (max <= 0)
+		max = (int) ceil(distribution_bound(&(attr->size),
+						    DEFAULT_MAX_SIZE));
+	if (max < MIN_PACKET_SIZE)
+		max = MIN_PACKET_SIZE;
+	this->max_size = max;
+
+	if (distribution_mean(&(attr->interval)) < 0)
+		fprintf(stderr, "WARNING: The interval distribution has an "
+			"infinite mean, the packet rate is undefined.\n");
+
+	rng_seed(&(attr->rng), seed, this->id);
+
+	return 0;
+}
+
+
+
+int distribution_generator_init(generator_t *this)
+{
+	struct distribution_generator_attr *attr =
+		(struct distribution_generator_attr *) this->attr;
+	const double interval = distribution_mean(&(attr->interval));
+	this->block = create_sized_block_circle(this, interval > 0 ?
+						interval * NS_PER_US : 0);
+	attr->values = malloc(this->block->length * sizeof(double));
+	CHKALLOC(attr->values);
+
+	struct packet_block *block = this->block;
+	do
+	{
+		distribution_generator_fill_block(this, block);
+		block = block->next;
+	} while (block != this->block);
+
+	return 0;
+}
+
+
+
+/* Refill the block with new random intervals and sizes */
+int distribution_generator_fill_block(generator_t *this,
+				      struct packet_block *current)
+{
+	struct distribution_generator_attr *attr =
+		(struct distribution_generator_attr *) this->attr;
+
+	distribution_sample_batch(&(attr->interval), &(attr->rng),
+				  attr->values, current->length);
+	for (int i = 0; i < current->length; i++)
+	{
+		const double d = attr->values[i] * NS_PER_US;
+		/* negative values can't be scheduled, huge ones would
+		 * overflow when rounded */
+		ns_to_timespec(!(d > 0) ? 0 : d < GENERATOR_MAX_DELAY ?
+			       llround(d) : GENERATOR_MAX_DELAY,
+			       &(current->data[i].delay));
+	}
+	distribution_sample_batch(&(attr->size), &(attr->rng),
+				  attr->values, current->length);
+	for (int i = 0; i < current->length; i++)
+	{
+		/* clamp before rounding, huge values would overflow */
+		const double s = attr->values[i];
+		if (!(s >= MIN_PACKET_SIZE))
+			current->data[i].size = MIN_PACKET_SIZE;
+		else if (s > this->max_size)
+			current->data[i].size = this->max_size;
+		else
+			current->data[i].size = lround(s);
+	}
+
+	return 0;
+}
+
+
+
+int distribution_generator_destroy(generator_t *this)
+{
+	struct distribution_generator_attr *attr =
+		(struct distribution_generator_attr *) this->attr;
+	int ret = 0;
+
+	ret = destroy_block_circle(this->block); // pass error, if any
+	this->block = NULL;
+	free(attr->values);
+	free(this->attr);
+	return ret;
+}
@@ -0,0 +1,339 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "alias.h"
+#include "empirical_generator.h"
+#include "luna.h"
+#include "rng.h"
+
+/* default packet interval (µs) */
+#define DEFAULT_INTERVAL 1000
+/* maximum line length in table files */
+#define TABLE_LINE_LEN 256
+
+int empirical_generator_init(generator_t *this);
+int empirical_generator_fill_block(generator_t *this,
+				   struct packet_block *current);
+int empirical_generator_destroy(generator_t *this);
+
+struct empirical_generator_attr
+{
+	/* the alias tables select an index into the matching value
+	 * array, values are converted in advance so filling a block
+	 * only copies them */
+	struct alias_table interval;
+	struct timespec *delays;
+	struct alias_table size;
+	int *sizes;
+	/* mean packet interval (ns) */
+	double mean;
+	struct rng rng;
+	/* random values for one block */
+	double *values;
+};
+
+/* values and weights read from a table file */
+struct table
+{
+	double *values;
+	double *weights;
+	uint32_t n;
+};
+
+
+
+/* Read a table file: One entry per line, consisting of a value and
+ * optionally its weight (default 1), separated by whitespace. Empty
+ * lines and lines starting with # are ignored. Exits if the file
+ * cannot be read or is invalid. */
+static void load_table(const char *const name, const char *const path,
+		       struct table *const table)
+{
+	FILE *const in = fopen(path, "r");
+	if (in == NULL)
+	{
+		fprintf(stderr, "ERROR: Could not open %s table \"%s\": %s\n",
+			name, path, strerror(errno));
+		exit(EXIT_FILEFAIL);
+	}
+
+	uint32_t capacity = 64;
+	table->n = 0;
+	table->values = malloc(capacity * sizeof(double));
+	CHKALLOC(table->values);
+	table->weights = malloc(capacity * sizeof(double));
+	CHKALLOC(table->weights);
+	char line[TABLE_LINE_LEN];
+	unsigned long lineno = 0;
+	while (fgets(line, sizeof(line), in) != NULL)
+	{
+		lineno++;
+		char *pos = line + strspn(line, " \t");
+		if (*pos == '#' || *pos == '\n' || *pos == '\0')
+			continue;
+		char *end;
+		const double value = strtod(pos, &end);
+		double weight = 1.0;
+		if (end != pos)
+		{
+			pos = end;
+			weight = strtod(pos, &end);
+			if (end == pos)
+				weight = 1.0;
+		}
+		if (!isfinite(value) || !(weight >= 0)
+		    || end[strspn(end, " \t\r\n")] != '\0')
+		{
+			fprintf(stderr, "ERROR: Invalid entry in %s table "
+				"\"%s\", line %lu!\n", name, path, lineno);
+			exit(EXIT_INVALID);
+		}
+		if (table->n == capacity)
+		{
+			capacity *= 2;
+			table->values = realloc(table->values,
+						capacity * sizeof(double));
+			CHKALLOC(table->values);
+			table->weights = realloc(table->weights,
+						 capacity * sizeof(double));
+			CHKALLOC(table->weights);
+		}
+		table->values[table->n] = value;
+		table->weights[table->n] = weight;
+		table->n++;
+	}
+	if (ferror(in))
+	{
+		fprintf(stderr, "ERROR: Could not read %s table \"%s\"!\n",
+			name, path);
+		exit(EXIT_FILEFAIL);
+	}
+	fclose(in);
+}
+
+
+
+/* Build the alias table for the table file, or for the single value
+ * fallback if path is NULL */
+static void build(const char *const name, const char *const path,
+		  const double fallback, struct table *const table,
+		  struct alias_table *const alias)
+{
+	if (path != NULL)
+		load_table(name, path, table);
+	else
+	{
+		table->n = 1;
+		table->values = malloc(sizeof(double));
+		CHKALLOC(table->values);
+		table->weights = malloc(sizeof(double));
+		CHKALLOC(table->weights);
+		table->values[0] = fallback;
+		table->weights[0] = 1.0;
+	}
+	if (alias_table_init(alias, table->weights, table->n) != 0)
+	{
+		fprintf(stderr, "ERROR: The %s table \"%s\" contains no "
+			"entries with positive weight!\n", name, path);
+		exit(EXIT_INVALID);
+	}
+}
+
+
+
+/*
+ * Create the generator. The parameters are taken from args. If args
+ * is NULL, or a parameter is missing, default values will be used.
+ *
+ * interval (i): table file with the distribution of the time
+ *		 between two packets (µs), default a constant interval
+ *		 of DEFAULT_INTERVAL
+ * size (s): table file with the distribution of the packet size
+ *	     (bytes), default the minimum size
+ * max (m): maximum packet size, larger values are replaced with it.
+ *	    Defaults to the largest size in the table.
+ * seed: seed for the random number generator, default
+ *	 RNG_DEFAULT_SEED
+ */
+int empirical_generator_create(generator_t *this, generator_option *args)
+{
+	this->init_generator = &empirical_generator_init;
+	this->fill_block = &empirical_generator_fill_block;
+	this->destroy_generator = &empirical_generator_destroy;
+
+	this->attr = malloc(sizeof(struct empirical_generator_attr));
+	CHKALLOC(this->attr);
+	struct empirical_generator_attr *attr =
+		(struct empirical_generator_attr *) this->attr;
+	const char *interval_file = NULL;
+	const char *size_file = NULL;
+	int max = 0;
+	unsigned long seed = RNG_DEFAULT_SEED;
+
+	if (args != NULL)
+	{
+		for (int i = 0; args[i].name != NULL; i++)
+		{
+			char *name = args[i].name;
+			char *value = args[i].value;
+			if (strcmp(name, "interval") == 0
+			    || strcmp(name, "i") == 0)
+				interval_file = value;
+			else if (strcmp(name, "size") == 0
+				 || strcmp(name, "s") == 0)
+				size_file = value;
+			else if (strcmp(name, "max") == 0
+				 || strcmp(name, "m") == 0)
+				max = atoi(value);
+			else if (strcmp(name, "seed") == 0)
+				seed = strtoul(value, NULL, 10);
+			else
+			{
+				fprintf(stderr, "ERROR: Unknown argument "
+					"\"%s\" for the empirical generator!\n",
+					name);
+				exit(EXIT_INVALID);
+			}
+		}
+	}
+
+	struct table table;
+	build("interval", interval_file, DEFAULT_INTERVAL, &table,
+	      &(attr->interval));
+	attr->delays = malloc(table.n * sizeof(struct timespec));
+	CHKALLOC(attr->delays);
+	double mean = 0;
+	double sum = 0;
+	for (uint32_t i = 0; i < table.n; i++)
+	{
+		/* µs to ns, negative values can't be scheduled, huge
+		 * ones would overflow when rounded */
+		double d = table.values[i] * NS_PER_US;
+		if (!(d > 0))
+			d = 0;
+		else if (d > GENERATOR_MAX_DELAY)
+			d = GENERATOR_MAX_DELAY;
+		ns_to_timespec(llround(d), &(attr->delays[i]));
+		mean += d * table.weights[i];
+		sum += table.weights[i];
+	}
+	attr->mean = mean / sum;
+	if (mean <= 0)
+		fprintf(stderr, "WARNING: The mean packet interval is zero, "
+			"packets will be sent as fast as possible.\n");
+	free(table.values);
+	free(table.weights);
+
+	build("size", size_file, MIN_PACKET_SIZE, &table, &(attr->size));
+	if (max <= 0)
+	{
+		double largest = MIN_PACKET_SIZE;
+		for (uint32_t i = 0; i < table.n; i++)
+			if (table.weights[i] > 0 && table.values[i] > largest)
+				largest = table.values[i];
+		max = lround(largest);
+	}
+	if (max < MIN_PACKET_SIZE)
+		max = MIN_PACKET_SIZE;
+	this->max_size = max;
+	attr->sizes = malloc(table.n * sizeof(int));
+	CHKALLOC(attr->sizes);
+	for (uint32_t i = 0; i < table.n; i++)
+	{
+		const double s = table.values[i];
+		if (s < MIN_PACKET_SIZE)
+			attr->sizes[i] = MIN_PACKET_SIZE;
+		else if (s > this->max_size)
+			attr->sizes[i] = this->max_size;
+		else
+			attr->sizes[i] = lround(s);
+	}
+	free(table.values);
+	free(table.weights);
+
+	rng_seed(&(attr->rng), seed, this->id);
+
+	return 0;
+}
+
+
+
+int empirical_generator_init(generator_t *this)
+{
+	struct empirical_generator_attr *attr =
+		(struct empirical_generator_attr *) this->attr;
+	this->block = create_sized_block_circle(this, attr->mean);
+	attr->values = malloc(this->block->length * sizeof(double));
+	CHKALLOC(attr->values);
+
+	struct packet_block *block = this->block;
+	do
+	{
+		empirical_generator_fill_block(this, block);
+		block = block->next;
+	} while (block != this->block);
+
+	return 0;
+}
+
+
+
+/* Refill the block with new random intervals and sizes */
+int empirical_generator_fill_block(generator_t *this,
+				   struct packet_block *current)
+{
+	struct empirical_generator_attr *attr =
+		(struct empirical_generator_attr *) this->attr;
+
+	rng_uniform(&(attr->rng), attr->values, current->length);
+	for (int i = 0; i < current->length; i++)
+		current->data[i].delay = attr->delays[
+			alias_table_pick(&(attr->interval), attr->values[i])];
+	rng_uniform(&(attr->rng), attr->values, current->length);
+	for (int i = 0; i < current->length; i++)
+		current->data[i].size = attr->sizes[
+			alias_table_pick(&(attr->size), attr->values[i])];
+
+	return 0;
+}
+
+
+
+int empirical_generator_destroy(generator_t *this)
+{
+	struct empirical_generator_attr *attr =
+		(struct empirical_generator_attr *) this->attr;
+	int ret = 0;
+
+	ret = destroy_block_circle(this->block); // pass error, if any
+	this->block = NULL;
+	alias_table_free(&(attr->interval));
+	alias_table_free(&(attr->size));
+	free(attr->delays);
+	free(attr->sizes);
+	free(attr->values);
+	free(this->attr);
+	return ret;
+}
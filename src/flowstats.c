@@ -0,0 +1,148 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "flowstats.h"
+
+#define WINDOW_WORDS (FLOW_STATS_WINDOW / 64)
+
+
+
+static inline int test_and_set(struct flow_stats *const stats,
+			       const int64_t seq)
+{
+	const uint32_t bit = (uint32_t) seq % FLOW_STATS_WINDOW;
+	const uint64_t mask = UINT64_C(1) << (bit % 64);
+	uint64_t *const word = &(stats->window[bit / 64]);
+	const int was_set = (*word & mask) != 0;
+	*word |= mask;
+	return was_set;
+}
+
+
+
+static inline void clear_bit(struct flow_stats *const stats, const int64_t seq)
+{
+	const uint32_t bit = (uint32_t) seq % FLOW_STATS_WINDOW;
+	stats->window[bit / 64] &= ~(UINT64_C(1) << (bit % 64));
+}
+
+
+
+void flow_stats_update(struct flow_stats *const stats, const int64_t seq,
+		       const int64_t recv_ns, const int64_t send_ns)
+{
+	/* RFC 3550 interarrival jitter: J += (|D| - J) / 16, with J
+	 * kept scaled by 16 to avoid losing precision */
+	const int64_t transit = recv_ns - send_ns;
+	if (stats->c.received > 0)
+	{
+		int64_t d = transit - stats->last_transit;
+		if (d < 0)
+			d = -d;
+		stats->jitter += d - ((stats->jitter + 8) >> 4);
+	}
+	stats->last_transit = transit;
+
+	if (stats->c.received++ == 0)
+	{
+		stats->first_seq = seq;
+		stats->max_seq = seq;
+		stats->c.expected = 1;
+		test_and_set(stats, seq);
+		return;
+	}
+
+	if (seq > stats->max_seq)
+	{
+		/* Advance the window, clearing the bits of the
+		 * sequence numbers that are skipped or fall out of
+		 * it. */
+		const int64_t gap = seq - stats->max_seq;
+		if (gap >= FLOW_STATS_WINDOW)
+			memset(stats->window, 0, sizeof(stats->window));
+		else
+			for (int64_t s = stats->max_seq + 1; s < seq; s++)
+				clear_bit(stats, s);
+		clear_bit(stats, seq);
+		stats->max_seq = seq;
+		stats->c.expected = seq - stats->first_seq + 1;
+		test_and_set(stats, seq);
+		return;
+	}
+
+	const int64_t depth = stats->max_seq - seq;
+	if (depth >= FLOW_STATS_WINDOW)
+	{
+		stats->c.late++;
+		if (seq < stats->first_seq)
+		{
+			stats->first_seq = seq;
+			stats->c.expected =
+				stats->max_seq - seq + 1;
+		}
+		return;
+	}
+	if (test_and_set(stats, seq))
+	{
+		stats->c.duplicates++;
+		return;
+	}
+	stats->c.reordered++;
+	if (depth > stats->max_reorder)
+		stats->max_reorder = depth;
+	if (seq < stats->first_seq)
+	{
+		stats->first_seq = seq;
+		stats->c.expected = stats->max_seq - seq + 1;
+	}
+}
+
+
+
+void flow_stats_report(FILE *const out, const char *const name,
+		       struct flow_stats *const stats, const int total)
+{
+	struct flow_counters c = stats->c;
+	if (!total)
+	{
+		c.received -= stats->last.received;
+		c.duplicates -= stats->last.duplicates;
+		c.reordered -= stats->last.reordered;
+		c.late -= stats->last.late;
+		c.expected -= stats->last.expected;
+		stats->last = stats->c;
+	}
+	/* Late packets may be duplicates, too, but there is no way to
+	 * tell. Counting them as new gives a lower bound for loss. */
+	const int64_t lost = c.expected - (c.received - c.duplicates);
+	const double loss_rate = c.expected > 0 ?
+		100.0 * lost / c.expected : 0.0;
+
+	fprintf(out, "%s: received %" PRId64 ", lost %" PRId64
+		" (%.3f%%), duplicates %" PRId64 ", reordered %" PRId64,
+		name, c.received, lost, loss_rate, c.duplicates, c.reordered);
+	if (total)
+		fprintf(out, " (max. depth %" PRId64 ")", stats->max_reorder);
+	fprintf(out, ", late %" PRId64 ", jitter %" PRId64 "ns\n",
+		c.late, flow_stats_jitter(stats));
+}
@@ -0,0 +1,96 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_FLOWSTATS_H__
+#define __LUNA_FLOWSTATS_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Number of sequence numbers below the highest one received for
+ * which duplicates and reordering can be told apart (must be a
+ * multiple of 64). Older packets are counted as late. */
+#define FLOW_STATS_WINDOW 1024
+
+/* counters that interval reports show the difference of */
+struct flow_counters
+{
+	/* packets received, including duplicates and late ones */
+	int64_t received;
+	/* packets received a second time (within the window) */
+	int64_t duplicates;
+	/* packets received after a higher sequence number */
+	int64_t reordered;
+	/* packets older than the window */
+	int64_t late;
+	/* number of sequence numbers from the first to the highest
+	 * one received */
+	int64_t expected;
+};
+
+/*
+ * Online statistics for one flow, updated in constant time per
+ * packet (amortized, advancing the window clears one bit per
+ * sequence number skipped):
+ *
+ * Loss, duplicates and reordering are tracked using a bitmap of the
+ * sequence numbers received in a window below the highest one. Jitter
+ * is the interarrival jitter as defined in RFC 3550, section 6.4.1,
+ * based on the difference between the kernel receive time and the
+ * send time in the packet.
+ */
+struct flow_stats
+{
+	struct flow_counters c;
+	/* counters at the last interval report */
+	struct flow_counters last;
+	/* largest distance of a reordered packet from the highest
+	 * sequence number at the time it arrived */
+	int64_t max_reorder;
+	/* first and highest sequence number received */
+	int64_t first_seq;
+	int64_t max_seq;
+	/* transit time (receive time - send time) of the previous
+	 * packet (ns) */
+	int64_t last_transit;
+	/* interarrival jitter, scaled by 16 (ns) */
+	int64_t jitter;
+	/* bit (seq % FLOW_STATS_WINDOW) is set if seq has been
+	 * received, for seq in (max_seq - FLOW_STATS_WINDOW, max_seq] */
+	uint64_t window[FLOW_STATS_WINDOW / 64];
+};
+
+/* Update the statistics with a received packet. recv_ns and send_ns
+ * are the kernel receive time and the send time from the packet. */
+void flow_stats_update(struct flow_stats *const stats, const int64_t seq,
+		       const int64_t recv_ns, const int64_t send_ns);
+
+/* Interarrival jitter (ns) */
+static inline int64_t flow_stats_jitter(const struct flow_stats *const stats)
+{
+	return stats->jitter / 16;
+}
+
+/* Write a summary of the flow statistics since the start (total != 0)
+ * or since the last interval report (total == 0) to out, as one line
+ * starting with the given name. Interval reports update the counters
+ * the next interval report refers to. */
+void flow_stats_report(FILE *const out, const char *const name,
+		       struct flow_stats *const stats, const int total);
+
+#endif /* __LUNA_FLOWSTATS_H__ */
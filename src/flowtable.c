@@ -0,0 +1,102 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flowtable.h"
+
+/* FNV-1a, 64 bit */
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+
+
+/* Hash the raw bytes of a socket address */
+static inline uint64_t hash_addr(const struct sockaddr *const addr,
+				 const socklen_t addrlen)
+{
+	const unsigned char *const bytes = (const unsigned char *) addr;
+	uint64_t hash = FNV_OFFSET;
+	for (socklen_t i = 0; i < addrlen; i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	/* the low bits select the slot, fold in the high ones */
+	return hash ^ (hash >> 32);
+}
+
+
+
+void flow_table_init(struct flow_table *const table)
+{
+	table->slots = calloc(FLOW_TABLE_SLOTS, sizeof(struct flow_slot));
+	CHKALLOC(table->slots);
+	touch_page(table->slots, FLOW_TABLE_SLOTS * sizeof(struct flow_slot));
+	table->index = calloc(FLOW_TABLE_MAX_FLOWS, sizeof(uint32_t));
+	CHKALLOC(table->index);
+	touch_page(table->index, FLOW_TABLE_MAX_FLOWS * sizeof(uint32_t));
+	table->count = 0;
+}
+
+
+
+void flow_table_destroy(struct flow_table *const table)
+{
+	free(table->slots);
+	free(table->index);
+	table->slots = NULL;
+	table->index = NULL;
+	table->count = 0;
+}
+
+
+
+uint32_t flow_table_lookup(struct flow_table *const table,
+			   const struct sockaddr *const addr,
+			   const socklen_t addrlen, int *const created)
+{
+	*created = 0;
+	if (addrlen > ADDRBUF_SIZE)
+		return FLOW_ID_NONE;
+
+	/* The table is never more than half full, so there is always
+	 * an empty slot that ends the search. */
+	for (uint64_t i = hash_addr(addr, addrlen);; i++)
+	{
+		const uint32_t pos = i & (FLOW_TABLE_SLOTS - 1);
+		struct flow_slot *const slot = &(table->slots[pos]);
+		if (slot->id == 0)
+		{
+			if (table->count == FLOW_TABLE_MAX_FLOWS)
+				return FLOW_ID_NONE;
+			memcpy(slot->addr, addr, addrlen);
+			slot->addrlen = addrlen;
+			table->index[table->count] = pos;
+			slot->id = ++(table->count);
+			*created = 1;
+			return slot->id - 1;
+		}
+		if (slot->addrlen == addrlen
+		    && memcmp(slot->addr, addr, addrlen) == 0)
+			return slot->id - 1;
+	}
+}
@@ -0,0 +1,82 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_FLOWTABLE_H__
+#define __LUNA_FLOWTABLE_H__
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "luna.h"
+
+/* Maximum number of flows (source address and port) in a table, and
+ * the number of slots (a power of two, twice the maximum number of
+ * flows to keep probe sequences short) */
+#define FLOW_TABLE_MAX_FLOWS 16384
+#define FLOW_TABLE_SLOTS (2 * FLOW_TABLE_MAX_FLOWS)
+/* returned for flows that do not fit into the table any more */
+#define FLOW_ID_NONE UINT32_MAX
+
+struct flow_slot
+{
+	/* flow ID + 1, 0 if the slot is empty */
+	uint32_t id;
+	socklen_t addrlen;
+	char addr[ADDRBUF_SIZE];
+};
+
+/*
+ * Hash table mapping source addresses to compact flow IDs, assigned
+ * in order of first appearance starting at 0. All memory is allocated
+ * at creation and the table never grows or rehashes, so lookups are
+ * safe in real-time code. Collisions are resolved by linear probing,
+ * flows are never removed.
+ */
+struct flow_table
+{
+	struct flow_slot *slots;
+	/* slot of each flow, indexed by flow ID */
+	uint32_t *index;
+	/* number of flows in the table */
+	uint32_t count;
+};
+
+/* Allocate and touch the memory for an empty table */
+void flow_table_init(struct flow_table *const table);
+
+/* Free the memory of the table, but not the struct itself */
+void flow_table_destroy(struct flow_table *const table);
+
+/* Get the ID of the flow addr belongs to, adding it to the table if
+ * it is new. *created is set to 1 for new flows, 0 otherwise. Returns
+ * FLOW_ID_NONE (with *created = 0) if the flow is new, but the table
+ * is full. */
+uint32_t flow_table_lookup(struct flow_table *const table,
+			   const struct sockaddr *const addr,
+			   const socklen_t addrlen, int *const created);
+
+/* Get the slot holding the address of the flow with the given ID,
+ * which must be lower than the number of flows in the table. */
+static inline const struct flow_slot *flow_table_get(
+	const struct flow_table *const table, const uint32_t id)
+{
+	return &(table->slots[table->index[id]]);
+}
+
+#endif /* __LUNA_FLOWTABLE_H__ */
@@ -20,14 +20,10 @@
 
 #include <math.h>
 #include <string.h>
-#include <gsl/gsl_rng.h>
-#include <gsl/gsl_randist.h>
 
 #include "luna.h"
 #include "gaussian_generator.h"
-
-/* TODO: meaningful block length */
-#define BLOCK_LEN 10
+#include "rng.h"
 
 int gaussian_generator_init(generator_t *this);
 int gaussian_generator_fill_block(generator_t *this,
@@ -40,8 +36,9 @@ struct gaussian_generator_attr
 	size_t mean;
 	double sigma;
 	struct timespec interval;
-	const gsl_rng_type *rng_type;
-	gsl_rng *rng;
+	struct rng rng;
+	/* random values for one block */
+	double *values;
 };
 
 
@@ -54,6 +51,8 @@ struct gaussian_generator_attr
  * interval (i): time between two packets (µs)
  * max (m): maximum packet size in bytes (must be at least 4)
  * sigma (s): standard deviation of packet size in bytes (double)
+ * seed: seed for the random number generator, default
+ *	 RNG_DEFAULT_SEED
  */
 static int gaussian_generator_base(generator_t *this, generator_option *args)
 {
@@ -65,8 +64,7 @@ static int gaussian_generator_base(generator_t *this, generator_option *args)
 	attr->max = 4 * MIN_PACKET_SIZE;
 	attr->sigma = -1.0; /* negative value is used later to detect init */
 	int interval = 1000;
-	gsl_rng_type *rng_type = NULL;
-	gsl_rng *rng = NULL;
+	unsigned long seed = RNG_DEFAULT_SEED;
 
 	if (args != NULL)
 	{
@@ -83,6 +81,8 @@ static int gaussian_generator_base(generator_t *this, generator_option *args)
 			if (strcmp(name, "interval") == 0
 			    || strcmp(name, "i") == 0)
 				interval = atoi(value);
+			if (strcmp(name, "seed") == 0)
+				seed = strtoul(value, NULL, 10);
 			// TODO: catch unknown params
 		}
 	}
@@ -97,6 +97,7 @@ static int gaussian_generator_base(generator_t *this, generator_option *args)
 
 	attr->interval.tv_sec = interval / US_PER_S;
 	attr->interval.tv_nsec = (interval % US_PER_S) * 1000;
+	rng_seed(&(attr->rng), seed, this->id);
 
 	return 0;
 }
@@ -109,15 +110,7 @@ int gaussian_generator_create(generator_t *this, generator_option *args)
 	this->fill_block = &gaussian_generator_fill_block;
 	this->destroy_generator = &gaussian_generator_destroy;
 
-	gaussian_generator_base(this, args);
-
-	struct gaussian_generator_attr *attr =
-		(struct gaussian_generator_attr *) this->attr;
-	gsl_rng_env_setup();
-	attr->rng_type = gsl_rng_default;
-	attr->rng = gsl_rng_alloc(attr->rng_type);
-
-	return 0;
+	return gaussian_generator_base(this, args);
 }
 
 
@@ -127,7 +120,10 @@ int gaussian_generator_init(generator_t *this)
 	struct gaussian_generator_attr *attr =
 		(struct gaussian_generator_attr *) this->attr;
 
-	this->block = create_block_circle(4, BLOCK_LEN);
+	this->block = create_sized_block_circle
+		(this, timespec_to_ns(&(attr->interval)));
+	attr->values = malloc(this->block->length * sizeof(double));
+	CHKALLOC(attr->values);
 
 	struct packet_block *block = this->block;
 	do
@@ -149,11 +145,12 @@ int gaussian_generator_fill_block(generator_t *this,
 	struct gaussian_generator_attr *attr =
 		(struct gaussian_generator_attr *) this->attr;
 
+	rng_gaussian(&(attr->rng), attr->values, current->length);
 	for (int i = 0; i < current->length; i++)
 	{
-		double d = gsl_ran_gaussian_ziggurat(attr->rng, attr->sigma);
-		size_t r = lround(d);
-		r += attr->mean;
+		const long d = lround(attr->values[i] * attr->sigma);
+		/* negative values must not wrap around */
+		size_t r = d < -(long) attr->mean ? 0 : attr->mean + d;
 		if (r < MIN_PACKET_SIZE)
 			r = MIN_PACKET_SIZE;
 		if (r > attr->max)
@@ -176,7 +173,7 @@ int gaussian_generator_destroy(generator_t *this)
 
 	ret = destroy_block_circle(this->block); // pass error, if any
 	this->block = NULL;
-	gsl_rng_free(attr->rng);
+	free(attr->values);
 	free(this->attr);
 	return ret;
 }
@@ -18,12 +18,72 @@
  */
 #include <config.h>
 
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
 
 #include "luna.h"
 #include "generator.h"
 
+/* minimum and maximum time the generator thread sleeps while waiting
+ * for a free block (ns) */
+#define GENERATOR_MIN_POLL (10 * NS_PER_US)
+#define GENERATOR_MAX_POLL (10000 * NS_PER_US)
+/* Size huge page arenas are rounded up to (bytes), the default huge
+ * page size on x86 and arm64 */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* Header of the memory area holding a circle of packet blocks. The
+ * block descriptors follow it, then the data of each block, starting
+ * on a new cache line. */
+struct block_arena
+{
+	_Alignas(CACHE_LINE_SIZE) size_t size;
+};
+
+/* Limits for create_sized_block_circle(): the circle should have
+ * about TARGET_BLOCK_COUNT blocks. Blocks have at least
+ * MIN_BLOCK_LEN elements so slow schedules don't switch blocks for
+ * every packet, and the circle is never larger than MAX_BLOCK_COUNT
+ * blocks of MAX_BLOCK_LEN elements. Without a known interval,
+ * FALLBACK_BLOCK_LEN is used. */
+#define TARGET_BLOCK_COUNT 8
+#define MIN_BLOCK_COUNT 2
+#define MAX_BLOCK_COUNT 64
+#define MIN_BLOCK_LEN 16
+#define MAX_BLOCK_LEN 4096
+#define FALLBACK_BLOCK_LEN 64
+
+#define ROUND_UP(x, align) (((x) + (align) - 1) / (align) * (align))
+
+/* Multiply all delays in the block by factor */
+static void scale_block(struct packet_block *const block, const double factor)
+{
+	for (int i = 0; i < block->length; i++)
+	{
+		struct timespec *const delay = &(block->data[i].delay);
+		ns_to_timespec((int64_t) (timespec_to_ns(delay) * factor),
+			       delay);
+	}
+}
+
+
+
+/* Total of the delays in the block (ns) */
+static int64_t block_duration(const struct packet_block *const block)
+{
+	int64_t duration = 0;
+	for (int i = 0; i < block->length; i++)
+		duration += timespec_to_ns(&(block->data[i].delay));
+	return duration;
+}
+
+
+
 void* run_generator(void *const arg)
 {
 	struct generator_t *const generator = (struct generator_t *) arg;
@@ -43,23 +103,100 @@ void* run_generator(void *const arg)
 		pthread_setschedprio(self, sched_param.sched_priority - 1);
 
 	generator->init_generator(generator);
+	generator->stats.block_len = generator->block->length;
+	generator->stats.min_ready = ULONG_MAX;
 	struct packet_block *block = generator->block;
+	double factor = generator->split;
+	if (generator->rate > 0)
+	{
+		int64_t duration = 0;
+		long packets = 0;
+		do
+		{
+			duration += block_duration(block);
+			packets += block->length;
+			block = block->next;
+		} while (block != generator->block);
+		if (duration > 0)
+			factor *= packets * (double) NS_PER_S
+				/ (duration * generator->rate);
+		else
+			fprintf(stderr, "WARNING: Generator without delays, "
+				"cannot scale it to %.1f packets/s!\n",
+				generator->rate);
+	}
+	if (factor != 1.0)
+		do
+		{
+			scale_block(block, factor);
+			block = block->next;
+		} while (block != generator->block);
+
+	generator->ring =
+		block_ring_create(generator->block,
+				  generator->fill_block != NULL);
+
+	/* While all blocks are in use, check for free ones about
+	 * twice per block, based on the mean block duration. The
+	 * sender does not notify the generator, so it never has to
+	 * make a system call to switch blocks. The lower limit keeps
+	 * bursts (blocks without delays) from making the generator
+	 * spin. */
+	int64_t duration = 0;
+	int count = 0;
+	do
+	{
+		duration += block_duration(block);
+		count++;
+		block = block->next;
+	} while (block != generator->block);
+	int64_t poll = duration / count / 2;
+	if (poll < GENERATOR_MIN_POLL)
+		poll = GENERATOR_MIN_POLL;
+	else if (poll > GENERATOR_MAX_POLL)
+		poll = GENERATOR_MAX_POLL;
+	struct timespec poll_interval;
+	ns_to_timespec(poll, &poll_interval);
 
 	sem_post(generator->ready);
 
+	/* static generators are done at this point */
+	if (generator->fill_block == NULL)
+		return NULL;
+
 	/* this loop will be stopped by thread cancellation */
 	while (1)
 	{
-		sem_wait(generator->control);
-		if (generator->fill_block != NULL)
+		if (!block_ring_writable(generator->ring))
 		{
-			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-			pthread_mutex_lock(block->lock);
-			generator->fill_block(generator, block);
-			pthread_mutex_unlock(block->lock);
-			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-			block = block->next;
+			/* clock_nanosleep is a cancellation point */
+			clock_nanosleep(CLOCK_MONOTONIC, 0,
+					&poll_interval, NULL);
+			continue;
 		}
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		const unsigned long ready = block_ring_ready(generator->ring);
+		struct timespec start;
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		generator->fill_block(generator, block);
+		if (factor != 1.0)
+			scale_block(block, factor);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		block_ring_publish(generator->ring);
+
+		struct generator_stats *const stats = &(generator->stats);
+		const int64_t fill = timespec_to_ns(&end)
+			- timespec_to_ns(&start);
+		stats->refills++;
+		stats->fill_time += fill;
+		if (fill > stats->max_fill_time)
+			stats->max_fill_time = fill;
+		stats->schedule_time += block_duration(block);
+		if (ready < stats->min_ready)
+			stats->min_ready = ready;
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		block = block->next;
 	}
 
 	return NULL;
@@ -67,44 +204,99 @@ void* run_generator(void *const arg)
 
 
 
-struct packet_block *create_block_circle(const int count, const int block_len)
+struct packet_block *create_block_circle(const generator_t *const generator,
+					 const int count, const int block_len)
 {
-	struct packet_block *block = malloc(sizeof(struct packet_block));
-	CHKALLOC(block);
-	packet_block_init(block, block_len);
-	struct packet_block *const first = block;
+	const size_t desc_size =
+		ROUND_UP(count * sizeof(struct packet_block), CACHE_LINE_SIZE);
+	const size_t data_size =
+		ROUND_UP(block_len * sizeof(struct packet_data),
+			 CACHE_LINE_SIZE);
+	size_t size = sizeof(struct block_arena) + desc_size
+		+ count * data_size;
+
+	/* MAP_POPULATE prefaults the arena, so the sender never
+	 * touches a new page */
+	void *mem = MAP_FAILED;
+	if (generator->hugepages)
+	{
+		mem = mmap(NULL, ROUND_UP(size, HUGE_PAGE_SIZE),
+			   PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB
+			   | MAP_POPULATE, -1, 0);
+		if (mem == MAP_FAILED)
+			perror("WARNING: Could not allocate huge pages for "
+			       "packet blocks");
+		else
+			size = ROUND_UP(size, HUGE_PAGE_SIZE);
+	}
+	if (mem == MAP_FAILED)
+	{
+		mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		if (mem == MAP_FAILED)
+		{
+			perror("Allocating packet blocks");
+			exit(EXIT_MEMFAIL);
+		}
+	}
 
-	for (int i = 1; i < count; i++)
+	struct block_arena *const arena = (struct block_arena *) mem;
+	arena->size = size;
+	struct packet_block *const blocks =
+		(struct packet_block *) (arena + 1);
+	char *const data = (char *) blocks + desc_size;
+	for (int i = 0; i < count; i++)
 	{
-		struct packet_block *next = malloc(sizeof(struct packet_block));
-		CHKALLOC(next);
-		packet_block_init(next, block_len);
-		block->next = next;
-		block = next;
+		blocks[i].length = block_len;
+		blocks[i].data = (struct packet_data *) (data + i * data_size);
+		blocks[i].next = &(blocks[(i + 1) % count]);
 	}
 
-	block->next = first;
+	return blocks;
+}
+
 
-	return first;
+
+struct packet_block *create_sized_block_circle(const generator_t *const generator,
+					       const double interval)
+{
+	/* interval of each sender after splitting and scaling */
+	double sender_interval = interval * generator->split;
+	if (generator->rate > 0)
+		sender_interval = NS_PER_S * generator->split / generator->rate;
+
+	int block_len = FALLBACK_BLOCK_LEN;
+	int count = TARGET_BLOCK_COUNT;
+	if (sender_interval > 0)
+	{
+		const double packets = generator->buffer_time / sender_interval;
+		const double len = ceil(packets / TARGET_BLOCK_COUNT);
+		block_len = len < MIN_BLOCK_LEN ? MIN_BLOCK_LEN
+			: len > MAX_BLOCK_LEN ? MAX_BLOCK_LEN : (int) len;
+		const double c = ceil(packets / block_len);
+		count = c < MIN_BLOCK_COUNT ? MIN_BLOCK_COUNT
+			: c > MAX_BLOCK_COUNT ? MAX_BLOCK_COUNT : (int) c;
+	}
+	return create_block_circle(generator, count, block_len);
 }
 
 
 
 int destroy_block_circle(struct packet_block *block)
 {
-	int ret = 0;
-	struct packet_block *next = block->next;
-	block->next = NULL;
-	struct packet_block *current = next;
-	while (current != NULL)
+	/* the descriptor with the lowest address is the first one in
+	 * the arena */
+	struct packet_block *first = block;
+	struct packet_block *current = block->next;
+	while (current != block)
 	{
-		next = current->next;
-		if (packet_block_destroy(current))
-			ret = 1; // pass error along
-		free(current);
-		current = next;
+		if (current < first)
+			first = current;
+		current = current->next;
 	}
-	return ret;
+	struct block_arena *const arena = ((struct block_arena *) first) - 1;
+	return munmap(arena, arena->size) == 0 ? 0 : 1;
 }
 
 
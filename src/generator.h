@@ -21,17 +21,47 @@
 
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdint.h>
 
 #include "traffic.h"
 
+/* Longest delay generators with random intervals schedule (ns, one
+ * day). Longer samples are cut to it before rounding, converting
+ * huge doubles to integers would overflow. */
+#define GENERATOR_MAX_DELAY (24 * 3600 * (int64_t) 1000000000)
+
+/*
+ * Statistics of the generator thread, written by run_generator()
+ * and read after the thread has terminated:
+ *
+ * block_len: length of the blocks after initialization
+ * refills: number of blocks filled after initialization
+ * fill_time, max_fill_time: total and longest time fill_block took
+ *			     (ns)
+ * schedule_time: total of the delays in the refilled blocks, the
+ *		  time the sender needs to consume them (ns)
+ * min_ready: lowest number of published blocks the sender had not
+ *	      released yet when a refill started, including the one
+ *	      it was sending from
+ */
+struct generator_stats
+{
+	int block_len;
+	long refills;
+	int64_t fill_time;
+	int64_t max_fill_time;
+	int64_t schedule_time;
+	unsigned long min_ready;
+};
+
 
 
 /*
  * Protype of a generic generator
  *
  * The functions must be thread-safe, but the generic generator code
- * will take care of thread management, including aquiring mutexes and
- * semaphore signalling.
+ * will take care of thread management, including synchronization
+ * with the sending thread.
  *
  * The generator MUST ensure that the generated packet sizes are not
  * below MIN_PACKET_SIZE (defined in luna.h).
@@ -44,11 +74,34 @@ struct generator_t
 	/* Generator posts to this semaphore when its initialization
 	 * is complete. */
 	sem_t *ready;
-	/* Semaphore to control dynamic data generation. The sending
-	 * thread posts to this after using one block of data. */
-	sem_t *control;
+	/* Synchronizes the blocks with the sending thread, set up by
+	 * run_generator() after init_generator. Must be freed after
+	 * the generator thread has terminated. */
+	struct block_ring *ring;
 	/* maximum packet size */
 	int max_size;
+	/* Index of the sender this generator feeds, generators mix it
+	 * into their random seed so senders don't repeat each other */
+	int id;
+	/* Number of senders the schedule of this generator is split
+	 * across. If greater than one, the generic generator code
+	 * multiplies all delays by this number after init_generator
+	 * and fill_block, so the senders together produce the
+	 * configured schedule. */
+	int split;
+	/* If greater than zero, the generic generator code scales all
+	 * delays after init_generator so that the mean packet rate
+	 * of the initial blocks is rate packets per second (before
+	 * the split), and applies the same factor to blocks filled
+	 * later. Used for rate sweeps. */
+	double rate;
+	/* If non-zero, create_block_circle() tries to allocate the
+	 * blocks on huge pages */
+	int hugepages;
+	/* Amount of schedule create_sized_block_circle() sizes the
+	 * circle for (ns) */
+	int64_t buffer_time;
+	struct generator_stats stats;
 	/* Custom attributes (depends on the individual generator
 	 * type) */
 	void *attr;
@@ -104,11 +157,25 @@ void* run_generator(void *const arg);
 
 
 /* Create a circular buffer of count packet blocks, with block_len
- * elements each. Returns a pointer to the first block. */
-struct packet_block *create_block_circle(const int count, const int block_len);
-
-/* Destry a circular buffer of count packet blocks. The function
- * follows the next pointers to delete all elements of the circle. */
+ * elements each. Returns a pointer to the first block. The
+ * descriptors and data of all blocks are allocated together in one
+ * prefaulted memory area, on huge pages if generator->hugepages is
+ * set and enough huge pages are available. */
+struct packet_block *create_block_circle(const generator_t *const generator,
+					 const int count, const int block_len);
+
+/* Create a circular buffer for a generator that refills its blocks,
+ * with the number and length of blocks chosen so the circle holds
+ * about generator->buffer_time of schedule. interval is the mean
+ * packet interval of the generator before splitting and rate
+ * scaling (ns), or 0 if it is unknown. All blocks have the same
+ * length, generators needing per-block buffers can read it from the
+ * first block. */
+struct packet_block *create_sized_block_circle(const generator_t *const generator,
+					       const double interval);
+
+/* Destroy a circular buffer created by create_block_circle(). Any
+ * block of the circle may be passed. */
 int destroy_block_circle(struct packet_block *block);
 
 /* Split an arguments string into a generator_option[]. The string is
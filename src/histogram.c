@@ -0,0 +1,163 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "histogram.h"
+#include "luna.h"
+
+
+
+/* Bucket index of a non-negative value */
+static inline int bucket_index(const int64_t value)
+{
+	if (value < HIST_SUB_COUNT)
+		return value;
+	int exp = 63 - __builtin_clzll(value);
+	if (exp > HIST_MAX_EXP)
+		return HIST_BUCKETS - 1;
+	/* the top HIST_SUB_BITS + 1 bits of the value, the highest
+	 * one of which is always set */
+	const int mantissa = value >> (exp - HIST_SUB_BITS);
+	return (exp - HIST_SUB_BITS + 1) * HIST_SUB_COUNT
+		+ mantissa - HIST_SUB_COUNT;
+}
+
+
+
+/* Middle of the range of values counted in a bucket */
+static inline int64_t bucket_value(const int index)
+{
+	if (index < HIST_SUB_COUNT)
+		return index;
+	const int shift = index / HIST_SUB_COUNT - 1;
+	const int64_t low = (int64_t) (index % HIST_SUB_COUNT + HIST_SUB_COUNT)
+		<< shift;
+	return low + ((INT64_C(1) << shift) >> 1);
+}
+
+
+
+void histogram_reset(struct histogram *const hist)
+{
+	memset(hist, 0, sizeof(struct histogram));
+}
+
+
+
+void histogram_record(struct histogram *const hist, const int64_t value)
+{
+	const int64_t v = value < 0 ? 0 : value;
+	if (hist->count == 0 || v < hist->min)
+		hist->min = v;
+	if (v > hist->max)
+		hist->max = v;
+	hist->count++;
+	hist->buckets[bucket_index(v)]++;
+}
+
+
+
+void histogram_merge(struct histogram *const dst,
+		     const struct histogram *const src)
+{
+	if (src->count == 0)
+		return;
+	if (dst->count == 0 || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	for (int i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+
+
+int64_t histogram_quantile(const struct histogram *const hist,
+			   const double q)
+{
+	if (hist->count == 0)
+		return 0;
+	/* rank of the value, counting from 1 */
+	int64_t rank = (int64_t) (q * hist->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	int64_t seen = 0;
+	for (int i = 0; i < HIST_BUCKETS; i++)
+	{
+		seen += hist->buckets[i];
+		if (seen >= rank)
+		{
+			/* the exact extremes are better than the
+			 * bucket estimate */
+			const int64_t v = bucket_value(i);
+			if (v > hist->max)
+				return hist->max;
+			if (v < hist->min)
+				return hist->min;
+			return v;
+		}
+	}
+	return hist->max;
+}
+
+
+
+/* Append ", label Nµs" for a value in ns, in microseconds with
+ * three decimal places, to the string in buf */
+static size_t append_us(char *const buf, const size_t pos, const size_t len,
+			const char *const label, const int64_t ns)
+{
+	const int ret = snprintf(buf + pos, len - pos, ", %s %ld.%03ldµs",
+				 label, (long) (ns / NS_PER_US),
+				 (long) (ns % NS_PER_US));
+	return ret < 0 || pos + ret >= len ? len - 1 : pos + ret;
+}
+
+
+
+void histogram_report(FILE *const out, const char *const name,
+		      const struct histogram *const hist)
+{
+	if (hist->count == 0)
+	{
+		fprintf(out, "%s: no values\n", name);
+		return;
+	}
+	/* The line is assembled first and written with a single call,
+	 * so reports from several threads don't get mixed up. */
+	char line[256];
+	size_t pos = snprintf(line, sizeof(line), "%s: %" PRId64 " values",
+			      name, hist->count);
+	if (pos >= sizeof(line))
+		pos = sizeof(line) - 1;
+	pos = append_us(line, pos, sizeof(line), "p50",
+			histogram_quantile(hist, 0.5));
+	pos = append_us(line, pos, sizeof(line), "p90",
+			histogram_quantile(hist, 0.9));
+	pos = append_us(line, pos, sizeof(line), "p99",
+			histogram_quantile(hist, 0.99));
+	pos = append_us(line, pos, sizeof(line), "p99.9",
+			histogram_quantile(hist, 0.999));
+	append_us(line, pos, sizeof(line), "max", hist->max);
+	fprintf(out, "%s\n", line);
+}
@@ -0,0 +1,68 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_HISTOGRAM_H__
+#define __LUNA_HISTOGRAM_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Log-linear latency histogram in the style of HdrHistogram: values
+ * below 2^HIST_SUB_BITS ns are counted exactly, larger ones in
+ * 2^HIST_SUB_BITS buckets per power of two, so the relative error of
+ * a quantile is below 2^-HIST_SUB_BITS (< 0.8%). The counts are part
+ * of the structure, recording a value never allocates memory.
+ */
+#define HIST_SUB_BITS 7
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+/* largest power of two with its own buckets, larger values (over 36
+ * minutes) are counted in the last bucket */
+#define HIST_MAX_EXP 41
+#define HIST_BUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 2) * HIST_SUB_COUNT)
+
+struct histogram
+{
+	int64_t count;
+	/* exact minimum and maximum recorded (ns) */
+	int64_t min;
+	int64_t max;
+	int64_t buckets[HIST_BUCKETS];
+};
+
+/* Reset the histogram to zero values */
+void histogram_reset(struct histogram *const hist);
+
+/* Record a value (ns), negative values are counted as 0 */
+void histogram_record(struct histogram *const hist, const int64_t value);
+
+/* Add all values recorded in src to dst */
+void histogram_merge(struct histogram *const dst,
+		     const struct histogram *const src);
+
+/* Get the value (ns) below which the fraction q (0 to 1) of recorded
+ * values lies, returns 0 if the histogram is empty */
+int64_t histogram_quantile(const struct histogram *const hist,
+			   const double q);
+
+/* Write the number of values, p50, p90, p99, p99.9 and maximum (in
+ * microseconds) to out, as one line starting with the given name */
+void histogram_report(FILE *const out, const char *const name,
+		      const struct histogram *const hist);
+
+#endif /* __LUNA_HISTOGRAM_H__ */
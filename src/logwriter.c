@@ -0,0 +1,232 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logwriter.h"
+#include "luna.h"
+
+/* size of the write buffer: one full write plus room for the record
+ * that crosses the boundary */
+#define LOG_BUF_SIZE (LOG_WRITE_SIZE + LOG_DIRECT_ALIGN)
+
+void *log_writer_thread(void *arg);
+
+
+
+/* write() all len bytes of buf, exit on error */
+static void write_all(const int fd, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		const ssize_t ret = write(fd, buf, len);
+		if (ret == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("Writing log");
+			exit(EXIT_FILEFAIL);
+		}
+		buf += ret;
+		len -= ret;
+	}
+}
+
+
+
+/* Write full blocks of LOG_WRITE_SIZE bytes from the buffer, and
+ * move the rest to its start */
+static void write_blocks(struct log_writer *const writer)
+{
+	if (writer->fill < LOG_WRITE_SIZE)
+		return;
+	write_all(writer->fd, writer->buf, LOG_WRITE_SIZE);
+	writer->fill -= LOG_WRITE_SIZE;
+	memmove(writer->buf, writer->buf + LOG_WRITE_SIZE, writer->fill);
+}
+
+
+
+/* Write everything in the buffer. If the file is opened with
+ * O_DIRECT, the last partial block can only be written after
+ * switching O_DIRECT off, so this must only happen at the end. */
+static void write_rest(struct log_writer *const writer)
+{
+	if (writer->fill == 0)
+		return;
+	write_all(writer->fd, writer->buf, writer->fill);
+	writer->fill = 0;
+}
+
+
+
+struct log_writer *log_writer_create(const int fd, const int direct,
+				     const log_format_t format,
+				     void *const format_arg,
+				     const void *const prefix,
+				     const size_t prefix_len)
+{
+	struct log_writer *const writer =
+		aligned_alloc(CACHE_LINE_SIZE, sizeof(struct log_writer));
+	CHKALLOC(writer);
+	memset(writer, 0, sizeof(struct log_writer));
+	atomic_init(&(writer->head), 0);
+	atomic_init(&(writer->tail), 0);
+	atomic_init(&(writer->stop), 0);
+	writer->fd = fd;
+	writer->direct = direct;
+	writer->format = format;
+	writer->format_arg = format_arg;
+
+	const size_t ring_size = LOG_RING_SIZE * sizeof(struct binlog_record);
+	writer->records = aligned_alloc(LOG_DIRECT_ALIGN, ring_size);
+	CHKALLOC(writer->records);
+	writer->buf = aligned_alloc(LOG_DIRECT_ALIGN, LOG_BUF_SIZE);
+	CHKALLOC(writer->buf);
+	/* The ring is written in the real-time loop, so it must not
+	 * cause page faults. mlockall() usually covers it already,
+	 * but might have failed, while a ring of this size may still
+	 * fit into the RLIMIT_MEMLOCK limit. */
+	if (mlock(writer->records, ring_size) != 0)
+		perror("Could not lock log ring");
+	touch_page(writer->records, ring_size);
+	touch_page(writer->buf, LOG_BUF_SIZE);
+
+	if (prefix_len > LOG_WRITE_SIZE)
+	{
+		fprintf(stderr, "Log header too long!\n");
+		exit(EXIT_FILEFAIL);
+	}
+	memcpy(writer->buf, prefix, prefix_len);
+	writer->fill = prefix_len;
+
+	const int ret = pthread_create(&(writer->thread), NULL,
+				       &log_writer_thread, writer);
+	if (ret != 0)
+	{
+		fprintf(stderr, "creating log writer thread failed: %s\n",
+			strerror(ret));
+		exit(1);
+	}
+	return writer;
+}
+
+
+
+void log_writer_close(struct log_writer *const writer,
+		      const char *const name)
+{
+	atomic_store_explicit(&(writer->stop), 1, memory_order_release);
+	pthread_join(writer->thread, NULL);
+
+	if (writer->direct)
+	{
+		const int fl = fcntl(writer->fd, F_GETFL);
+		fcntl(writer->fd, F_SETFL, fl & ~O_DIRECT);
+	}
+	write_rest(writer);
+
+	if (name != NULL)
+		fprintf(stderr, "%s: %lu of %u ring entries used at most, "
+			"%lu records dropped.\n", name,
+			writer->high_water, LOG_RING_SIZE, writer->dropped);
+
+	munlock(writer->records, LOG_RING_SIZE * sizeof(struct binlog_record));
+	free(writer->records);
+	free(writer->buf);
+	free(writer);
+}
+
+
+
+/* Writer thread: Move records from the ring to the write buffer until
+ * stopped and the ring is empty. */
+void *log_writer_thread(void *arg)
+{
+	struct log_writer *const writer = (struct log_writer *) arg;
+	const struct timespec poll = {0, LOG_WRITER_POLL};
+
+	/* The ring absorbs disk stalls, so the writer must never
+	 * compete with the real-time loop for the CPU. Run at the
+	 * lowest priority of the current scheduling policy. */
+	const pthread_t self = pthread_self();
+	int sched_policy = 0;
+	struct sched_param sched_param;
+	pthread_getschedparam(self, &sched_policy, &sched_param);
+	pthread_setschedprio(self, sched_get_priority_min(sched_policy));
+
+	while (1)
+	{
+		/* check stop before head, so records pushed before
+		 * the stop flag was set are always seen */
+		const int stop = atomic_load_explicit(&(writer->stop),
+						      memory_order_acquire);
+		const unsigned long head =
+			atomic_load_explicit(&(writer->head),
+					     memory_order_acquire);
+		unsigned long tail =
+			atomic_load_explicit(&(writer->tail),
+					     memory_order_relaxed);
+		if (tail == head)
+		{
+			if (stop)
+				break;
+			/* Nothing to do, write out what's there
+			 * unless that would require unaligned direct
+			 * I/O. Under load the ring is rarely empty, so
+			 * writes stay large. */
+			if (!writer->direct)
+				write_rest(writer);
+			nanosleep(&poll, NULL);
+			continue;
+		}
+
+		for (; tail != head; tail++)
+		{
+			const struct binlog_record *const rec =
+				&(writer->records[tail & (LOG_RING_SIZE - 1)]);
+			if (writer->format == NULL)
+			{
+				memcpy(writer->buf + writer->fill, rec,
+				       sizeof(struct binlog_record));
+				writer->fill += sizeof(struct binlog_record);
+			}
+			else
+				writer->fill += writer->format(
+					writer->format_arg, rec,
+					writer->buf + writer->fill);
+			/* release each record right away, so the
+			 * producer gets the space back even if the
+			 * write below blocks */
+			atomic_store_explicit(&(writer->tail), tail + 1,
+					      memory_order_release);
+			write_blocks(writer);
+		}
+	}
+	return NULL;
+}
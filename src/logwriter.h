@@ -0,0 +1,124 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_LOGWRITER_H__
+#define __LUNA_LOGWRITER_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "binlog.h"
+#include "luna.h"
+#include "traffic.h"
+
+/* Number of records in the ring between the receive loop and the
+ * writer thread (must be a power of two). 2^16 records are 2 MiB and
+ * buffer about 65ms at 1 Mpps. */
+#define LOG_RING_SIZE (1 << 16)
+/* Size of regular writes to the log file, a multiple of
+ * LOG_DIRECT_ALIGN and sizeof(struct binlog_record) */
+#define LOG_WRITE_SIZE (1024 * 1024)
+/* Alignment of buffer, write size and file offset required for
+ * O_DIRECT */
+#define LOG_DIRECT_ALIGN 4096
+/* Maximum length of one record formatted as text */
+#define LOG_LINE_MAX 256
+/* Time the writer thread sleeps when the ring is empty (ns) */
+#define LOG_WRITER_POLL (1000 * NS_PER_US)
+
+/* Format a record as text into buf (at most LOG_LINE_MAX bytes, no
+ * terminating null byte required), return the length. Records that
+ * don't produce output (e.g. flow records) return 0. arg is the
+ * format_arg passed to log_writer_create(). */
+typedef size_t (*log_format_t)(void *arg, const struct binlog_record *rec,
+			       char *buf);
+
+/*
+ * Single producer, single consumer ring of log records between a
+ * real-time loop and the writer thread, which formats the records and
+ * writes them to disk in large blocks. Like struct block_ring, both
+ * sides only count records:
+ *
+ * head: number of records pushed by the producer
+ * tail: number of records consumed by the writer thread
+ *
+ * If the ring is full, records are dropped rather than blocking the
+ * producer.
+ */
+struct log_writer
+{
+	_Alignas(CACHE_LINE_SIZE) atomic_ulong head;
+	_Alignas(CACHE_LINE_SIZE) atomic_ulong tail;
+	/* producer statistics: records dropped because the ring was
+	 * full, and the maximum number of records in the ring */
+	_Alignas(CACHE_LINE_SIZE) unsigned long dropped;
+	unsigned long high_water;
+	/* set to stop the writer thread once the ring is empty */
+	atomic_int stop;
+	_Alignas(CACHE_LINE_SIZE) struct binlog_record *records;
+	/* output file descriptor, the writer does not close it */
+	int fd;
+	/* non-zero if fd has been opened with O_DIRECT */
+	int direct;
+	/* NULL to write records as binary */
+	log_format_t format;
+	void *format_arg;
+	/* write buffer */
+	char *buf;
+	size_t fill;
+	pthread_t thread;
+};
+
+/* Allocate and lock the ring and start the writer thread. The prefix
+ * (e.g. a log header) is written before any records. */
+struct log_writer *log_writer_create(const int fd, const int direct,
+				     const log_format_t format,
+				     void *const format_arg,
+				     const void *const prefix,
+				     const size_t prefix_len);
+
+/* Wait until the writer thread has written all records in the ring
+ * and free the writer. If name is not NULL, statistics are reported
+ * to stderr, prefixed with the name. */
+void log_writer_close(struct log_writer *const writer,
+		      const char *const name);
+
+/* Producer side: Add a record to the ring. Returns 0 on success, -1
+ * if the ring was full and the record has been dropped. */
+static inline int log_writer_push(struct log_writer *const writer,
+				  const struct binlog_record *const rec)
+{
+	const unsigned long head =
+		atomic_load_explicit(&(writer->head), memory_order_relaxed);
+	const unsigned long used = head -
+		atomic_load_explicit(&(writer->tail), memory_order_acquire);
+	if (used >= LOG_RING_SIZE)
+	{
+		writer->dropped++;
+		return -1;
+	}
+	if (used + 1 > writer->high_water)
+		writer->high_water = used + 1;
+	writer->records[head & (LOG_RING_SIZE - 1)] = *rec;
+	atomic_store_explicit(&(writer->head), head + 1,
+			      memory_order_release);
+	return 0;
+}
+
+#endif /* __LUNA_LOGWRITER_H__ */
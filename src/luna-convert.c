@@ -0,0 +1,301 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * luna-convert: Convert binary LUNA logs (see binlog.h) to the tab
+ * separated format written by LUNA with the -T option.
+ */
+#include <config.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "binlog.h"
+#include "clockoffset.h"
+#include "luna.h"
+
+/* flow names indexed by flow ID */
+struct flow_table
+{
+	struct binlog_flow_names *names;
+	size_t len;
+	/* names for BINLOG_FLOW_OTHER */
+	struct binlog_flow_names other;
+	/* clock offset estimates indexed by flow ID (sender) for echo
+	 * logs with server timestamps */
+	struct clock_offset *offsets;
+	size_t offsets_len;
+};
+
+
+
+/* Write a time in nanoseconds as microseconds with three decimal
+ * places, like LUNA's TSV output does */
+static void print_time(FILE *const out, const int64_t ns)
+{
+	const long sec = ns / NS_PER_S;
+	const long nsec = ns % NS_PER_S;
+	fprintf(out, "%ld%06ld.%03ld", sec, nsec / NS_PER_US,
+		nsec % NS_PER_US);
+}
+
+
+
+/* Store the text form of the address in a flow record */
+static void add_flow(struct flow_table *const table,
+		     const struct binlog_record *const rec)
+{
+	const uint32_t id = rec->flow;
+	if (id == BINLOG_FLOW_OTHER)
+	{
+		binlog_flow_names(rec, &(table->other));
+		return;
+	}
+	if (id >= table->len)
+	{
+		size_t len = table->len > 0 ? table->len : 16;
+		while (len <= id)
+			len *= 2;
+		struct binlog_flow_names *names =
+			realloc(table->names,
+				len * sizeof(struct binlog_flow_names));
+		if (names == NULL)
+		{
+			fprintf(stderr, "Could not allocate flow table.\n");
+			exit(EXIT_MEMFAIL);
+		}
+		memset(names + table->len, 0,
+		       (len - table->len) * sizeof(struct binlog_flow_names));
+		table->names = names;
+		table->len = len;
+	}
+
+	if (binlog_flow_names(rec, &(table->names[id])) != 0)
+		fprintf(stderr, "Invalid address in flow %u!\n", id);
+}
+
+
+
+/* Get the clock offset estimator for a flow */
+static struct clock_offset *flow_offset(struct flow_table *const table,
+					const uint32_t id)
+{
+	if (id >= table->offsets_len)
+	{
+		size_t len = table->offsets_len > 0 ? table->offsets_len : 16;
+		while (len <= id)
+			len *= 2;
+		struct clock_offset *offsets =
+			realloc(table->offsets,
+				len * sizeof(struct clock_offset));
+		if (offsets == NULL)
+		{
+			fprintf(stderr, "Could not allocate flow table.\n");
+			exit(EXIT_MEMFAIL);
+		}
+		for (size_t i = table->offsets_len; i < len; i++)
+			clock_offset_init(&(offsets[i]));
+		table->offsets = offsets;
+		table->offsets_len = len;
+	}
+	return &(table->offsets[id]);
+}
+
+
+
+/* Write the TSV line for a packet record */
+static void print_packet(FILE *const out,
+			 const struct binlog_header *const hdr,
+			 struct flow_table *const table,
+			 const struct binlog_record *const rec,
+			 const struct binlog_record *const stamps)
+{
+	print_time(out, rec->data.packet.time);
+	switch (hdr->type)
+	{
+	case BINLOG_TYPE_SERVER:
+	{
+		if (hdr->flags & BINLOG_FLAG_KUTIME)
+		{
+			fputc('\t', out);
+			print_time(out, rec->data.packet.value);
+		}
+		const struct binlog_flow_names *names = NULL;
+		if (rec->flow == BINLOG_FLOW_OTHER)
+			names = &(table->other);
+		else if (rec->flow < table->len)
+			names = &(table->names[rec->flow]);
+		if (names != NULL && !names->valid)
+			names = NULL;
+		fprintf(out, "\t%s\t%s\t%" PRId64 "\t%u\n",
+			names != NULL ? names->addr : "?",
+			names != NULL ? names->port : "?",
+			rec->data.packet.sequence, rec->size);
+		break;
+	}
+	case BINLOG_TYPE_ECHO:
+		fprintf(out, "\t%" PRId64 "\t%u\t%ld.%03ld",
+			rec->data.packet.sequence, rec->size,
+			(long) (rec->data.packet.value / NS_PER_US),
+			(long) (rec->data.packet.value % NS_PER_US));
+		if (!(hdr->flags & BINLOG_FLAG_STAMPS))
+			fputc('\n', out);
+		else if (stamps == NULL)
+			fprintf(out, "\tNaN\tNaN\tNaN\tNaN\n");
+		else
+		{
+			/* the send time is the receive time minus
+			 * the RTT */
+			const int64_t send = rec->data.packet.time
+				- rec->data.packet.value;
+			/* same estimate as the client calculates
+			 * for text logs */
+			struct clock_offset *const est =
+				flow_offset(table, rec->flow);
+			clock_offset_sample(est, send,
+					    stamps->data.packet.time,
+					    stamps->data.packet.value,
+					    rec->data.packet.time);
+			fprintf(out, "\t%.3f\t%.3f\t%.3f\t%.3f\n",
+				(double) (stamps->data.packet.time - send)
+				/ NS_PER_US,
+				(double) (rec->data.packet.time
+					  - stamps->data.packet.value)
+				/ NS_PER_US,
+				(double) (stamps->data.packet.value
+					  - stamps->data.packet.time)
+				/ NS_PER_US,
+				(double) clock_offset_at(est, send)
+				/ NS_PER_US);
+		}
+		break;
+	case BINLOG_TYPE_TXSTAMP:
+		fprintf(out, "\t%u\t%" PRId64 "\t%c\n",
+			rec->flow, rec->data.packet.sequence,
+			rec->flags & BINLOG_TX_HARDWARE ? 'h' : 's');
+		break;
+	}
+}
+
+
+
+int main(int argc, char *argv[])
+{
+	if (argc > 3 || (argc > 1 && (strcmp(argv[1], "-h") == 0
+				      || strcmp(argv[1], "--help") == 0)))
+	{
+		fprintf(stderr, "Usage: %s [INPUT [OUTPUT]]\n"
+			"Convert a binary LUNA log to tab separated values. "
+			"Standard input and\noutput are used if INPUT or "
+			"OUTPUT are missing or \"-\".\n", argv[0]);
+		exit(EXIT_INVALID);
+	}
+
+	FILE *in = stdin;
+	if (argc > 1 && strcmp(argv[1], "-") != 0)
+	{
+		in = fopen(argv[1], "r");
+		if (in == NULL)
+		{
+			perror("Opening input file");
+			exit(EXIT_FILEFAIL);
+		}
+	}
+	FILE *out = stdout;
+	if (argc > 2 && strcmp(argv[2], "-") != 0)
+	{
+		out = fopen(argv[2], "w");
+		if (out == NULL)
+		{
+			perror("Opening output file");
+			exit(EXIT_FILEFAIL);
+		}
+	}
+	setvbuf(in, NULL, _IOFBF, BINLOG_BUF_SIZE);
+
+	struct binlog_header hdr;
+	if (binlog_read_header(in, &hdr) != 0)
+		exit(EXIT_FILEFAIL);
+
+	switch (hdr.type)
+	{
+	case BINLOG_TYPE_SERVER:
+		if (hdr.flags & BINLOG_FLAG_KUTIME)
+			fprintf(out, "# ktime\tutime\tsource\tport\t"
+				"sequence\tsize\n");
+		else
+			fprintf(out, "# ktime\tsource\tport\tsequence\tsize\n");
+		break;
+	case BINLOG_TYPE_ECHO:
+		if (hdr.flags & BINLOG_FLAG_STAMPS)
+			fprintf(out, "# ktime\tsequence\tsize\trtt\t"
+				"forward\treverse\tresidence\toffset\n");
+		else
+			fprintf(out, "# ktime\tsequence\tsize\trtt\n");
+		break;
+	case BINLOG_TYPE_TXSTAMP:
+		fprintf(out, "# txtime\tsender\tsequence\tsource\n");
+		break;
+	default:
+		fprintf(stderr, "Unknown log type %u!\n", hdr.type);
+		exit(EXIT_FILEFAIL);
+	}
+
+	struct flow_table table;
+	memset(&table, 0, sizeof(table));
+	struct binlog_record rec;
+	/* server timestamps belong to the packet record that
+	 * follows */
+	struct binlog_record stamps;
+	int have_stamps = 0;
+	while (fread(&rec, sizeof(rec), 1, in) == 1)
+	{
+		if (rec.type == BINLOG_REC_PACKET)
+		{
+			print_packet(out, &hdr, &table, &rec,
+				     have_stamps ? &stamps : NULL);
+			have_stamps = 0;
+		}
+		else if (rec.type == BINLOG_REC_FLOW)
+			add_flow(&table, &rec);
+		else if (rec.type == BINLOG_REC_STAMPS)
+		{
+			stamps = rec;
+			have_stamps = 1;
+		}
+	}
+	if (ferror(in))
+	{
+		perror("Reading binary log");
+		exit(EXIT_FILEFAIL);
+	}
+
+	free(table.names);
+	free(table.offsets);
+	if (in != stdin)
+		fclose(in);
+	if (out != stdout && fclose(out) != 0)
+	{
+		perror("Closing output file");
+		exit(EXIT_FILEFAIL);
+	}
+	return 0;
+}
@@ -0,0 +1,415 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * luna-schedule: Create a replay schedule (see schedule.h) for the
+ * replay generator from a packet capture in pcap format or from a
+ * LUNA server log (binary or tab separated).
+ */
+#include <config.h>
+
+#include <byteswap.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "binlog.h"
+#include "luna.h"
+#include "schedule.h"
+
+/* pcap file magic numbers for microsecond and nanosecond
+ * timestamps */
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+/* supported pcap link types */
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+/* Ethernet types */
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88a8
+/* largest captured frame LUNA can handle */
+#define PCAP_MAX_FRAME (256 * 1024)
+#define UDP_HEADER_SIZE 8
+/* largest UDP payload */
+#define MAX_UDP_PAYLOAD 65507
+/* maximum line length of tab separated logs */
+#define TSV_LINE_LEN 1024
+
+struct pcap_header
+{
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t network;
+};
+
+struct pcap_record
+{
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+
+/* Output state */
+struct schedule_writer
+{
+	FILE *out;
+	struct schedule_header hdr;
+	/* time of the previous packet (ns), -1 before the first */
+	int64_t last;
+	/* packets that were skipped or earlier than the previous
+	 * one */
+	uint64_t skipped;
+	uint64_t reordered;
+};
+
+
+
+/* Write one record, exits on error */
+static void write_record(struct schedule_writer *const w,
+			 const uint32_t delay, const uint32_t size)
+{
+	const struct schedule_record rec = {delay, size};
+	if (fwrite(&rec, sizeof(rec), 1, w->out) != 1)
+	{
+		perror("Writing schedule");
+		exit(EXIT_FILEFAIL);
+	}
+	w->hdr.count++;
+}
+
+
+
+/* Add a packet received at time (ns) with the given UDP payload
+ * size to the schedule */
+static void add_packet(struct schedule_writer *const w, const int64_t time,
+		       long size)
+{
+	int64_t delay = 0;
+	if (w->last >= 0)
+		delay = time - w->last;
+	/* packets out of order are sent right after the previous
+	 * one */
+	if (delay < 0)
+	{
+		w->reordered++;
+		delay = 0;
+	}
+	else
+		w->last = time;
+
+	while (delay > SCHEDULE_MAX_DELAY)
+	{
+		write_record(w, SCHEDULE_MAX_DELAY, 0);
+		delay -= SCHEDULE_MAX_DELAY;
+	}
+	if (size < MIN_PACKET_SIZE)
+		size = MIN_PACKET_SIZE;
+	if (size > MAX_UDP_PAYLOAD)
+		size = MAX_UDP_PAYLOAD;
+	write_record(w, delay, size);
+	if (size > w->hdr.max_size)
+		w->hdr.max_size = size;
+}
+
+
+
+static inline uint16_t read_be16(const uint8_t *const p)
+{
+	return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+
+
+/* Length of the IP payload of a captured frame, or -1 if the frame
+ * is not an IP packet or too short. The length is taken from the IP
+ * header, so it is correct for frames cut short by the capture. */
+static long ip_payload(const uint8_t *const frame, const size_t len,
+		       const uint32_t linktype)
+{
+	size_t offset = 0;
+	uint16_t ethertype = 0;
+	switch (linktype)
+	{
+	case LINKTYPE_ETHERNET:
+		if (len < 14)
+			return -1;
+		ethertype = read_be16(frame + 12);
+		offset = 14;
+		while ((ethertype == ETHERTYPE_VLAN
+			|| ethertype == ETHERTYPE_QINQ) && len >= offset + 4)
+		{
+			ethertype = read_be16(frame + offset + 2);
+			offset += 4;
+		}
+		if (ethertype != ETHERTYPE_IPV4 && ethertype != ETHERTYPE_IPV6)
+			return -1;
+		break;
+	case LINKTYPE_LINUX_SLL:
+		if (len < 16)
+			return -1;
+		offset = 16;
+		break;
+	case LINKTYPE_LINUX_SLL2:
+		offset = 20;
+		break;
+	default:
+		/* raw IP */
+		break;
+	}
+	if (len < offset + 1)
+		return -1;
+
+	const uint8_t *const ip = frame + offset;
+	const int version = ip[0] >> 4;
+	if (version == 4 && len >= offset + 20)
+		return (long) read_be16(ip + 2) - (ip[0] & 0x0f) * 4;
+	if (version == 6 && len >= offset + 40)
+		return read_be16(ip + 4);
+	return -1;
+}
+
+
+
+/* Convert a pcap file. Each IP packet becomes a UDP packet with the
+ * same IP payload length, other frames are skipped. */
+static void convert_pcap(FILE *const in, struct schedule_writer *const w)
+{
+	struct pcap_header hdr;
+	if (fread(&hdr, sizeof(hdr), 1, in) != 1)
+	{
+		fprintf(stderr, "Could not read pcap header.\n");
+		exit(EXIT_FILEFAIL);
+	}
+	const int swapped = hdr.magic == bswap_32(PCAP_MAGIC_US)
+		|| hdr.magic == bswap_32(PCAP_MAGIC_NS);
+	const uint32_t magic = swapped ? bswap_32(hdr.magic) : hdr.magic;
+	const int64_t frac_ns = magic == PCAP_MAGIC_NS ? 1 : NS_PER_US;
+	const uint32_t linktype = swapped ? bswap_32(hdr.network) : hdr.network;
+	if (linktype != LINKTYPE_ETHERNET && linktype != LINKTYPE_RAW
+	    && linktype != LINKTYPE_LINUX_SLL && linktype != LINKTYPE_IPV4
+	    && linktype != LINKTYPE_IPV6 && linktype != LINKTYPE_LINUX_SLL2)
+	{
+		fprintf(stderr, "Unsupported pcap link type %u.\n", linktype);
+		exit(EXIT_FILEFAIL);
+	}
+
+	uint8_t *const frame = malloc(PCAP_MAX_FRAME);
+	if (frame == NULL)
+	{
+		fprintf(stderr, "Could not allocate frame buffer.\n");
+		exit(EXIT_MEMFAIL);
+	}
+	struct pcap_record rec;
+	while (fread(&rec, sizeof(rec), 1, in) == 1)
+	{
+		if (swapped)
+		{
+			rec.ts_sec = bswap_32(rec.ts_sec);
+			rec.ts_frac = bswap_32(rec.ts_frac);
+			rec.incl_len = bswap_32(rec.incl_len);
+		}
+		if (rec.incl_len > PCAP_MAX_FRAME
+		    || fread(frame, 1, rec.incl_len, in) != rec.incl_len)
+		{
+			fprintf(stderr, "Invalid or truncated pcap record.\n");
+			exit(EXIT_FILEFAIL);
+		}
+		const long payload = ip_payload(frame, rec.incl_len, linktype);
+		if (payload < 0)
+		{
+			w->skipped++;
+			continue;
+		}
+		add_packet(w, (int64_t) rec.ts_sec * NS_PER_S
+			   + rec.ts_frac * frac_ns,
+			   payload - UDP_HEADER_SIZE);
+	}
+	free(frame);
+}
+
+
+
+/* Convert a binary LUNA server log */
+static void convert_binlog(FILE *const in, struct schedule_writer *const w)
+{
+	struct binlog_header hdr;
+	if (binlog_read_header(in, &hdr) != 0)
+		exit(EXIT_FILEFAIL);
+	if (hdr.type != BINLOG_TYPE_SERVER)
+	{
+		fprintf(stderr, "Only server logs can be converted.\n");
+		exit(EXIT_FILEFAIL);
+	}
+	struct binlog_record rec;
+	while (fread(&rec, sizeof(rec), 1, in) == 1)
+		if (rec.type == BINLOG_REC_PACKET)
+			add_packet(w, rec.data.packet.time, rec.size);
+}
+
+
+
+/* Convert a tab separated LUNA server log: the receive time (µs,
+ * three decimal places) is the first column, the size the last
+ * one */
+static void convert_tsv(FILE *const in, struct schedule_writer *const w)
+{
+	char line[TSV_LINE_LEN];
+	while (fgets(line, sizeof(line), in) != NULL)
+	{
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		char *end = NULL;
+		/* parsed in two parts, a double could not hold
+		 * nanoseconds */
+		int64_t time = strtoll(line, &end, 10) * NS_PER_US;
+		if (end == line)
+		{
+			w->skipped++;
+			continue;
+		}
+		if (*end == '.')
+		{
+			long ns = 0;
+			int digits = 0;
+			for (end++; isdigit(*end); end++)
+				if (digits < 3)
+				{
+					ns = ns * 10 + (*end - '0');
+					digits++;
+				}
+			for (; digits < 3; digits++)
+				ns *= 10;
+			time += ns;
+		}
+		const char *const last = strrchr(line, '\t');
+		if (last == NULL)
+		{
+			w->skipped++;
+			continue;
+		}
+		add_packet(w, time, atol(last + 1));
+	}
+}
+
+
+
+int main(int argc, char *argv[])
+{
+	long loops = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "l:h")) != -1)
+	{
+		if (opt == 'l')
+			loops = atol(optarg);
+		else
+			argc = 0;
+	}
+	if (argc - optind != 2 || loops < 0)
+	{
+		fprintf(stderr, "Usage: %s [-l LOOPS] INPUT OUTPUT\n"
+			"Create a replay schedule from a pcap file or a LUNA "
+			"server log (binary or tab\nseparated). LOOPS is how "
+			"often the schedule is played, 0 for endless.\n",
+			argv[0]);
+		exit(EXIT_INVALID);
+	}
+
+	FILE *const in = fopen(argv[optind], "r");
+	if (in == NULL)
+	{
+		perror("Opening input file");
+		exit(EXIT_FILEFAIL);
+	}
+	struct schedule_writer w;
+	memset(&w, 0, sizeof(w));
+	w.last = -1;
+	w.out = fopen(argv[optind + 1], "w");
+	if (w.out == NULL)
+	{
+		perror("Opening output file");
+		exit(EXIT_FILEFAIL);
+	}
+	setvbuf(in, NULL, _IOFBF, BINLOG_BUF_SIZE);
+	setvbuf(w.out, NULL, _IOFBF, BINLOG_BUF_SIZE);
+	schedule_init_header(&(w.hdr));
+	w.hdr.loops = loops;
+	/* the header is written again with the final values at the
+	 * end */
+	if (fwrite(&(w.hdr), sizeof(w.hdr), 1, w.out) != 1)
+	{
+		perror("Writing schedule");
+		exit(EXIT_FILEFAIL);
+	}
+
+	/* detect the input format from its first bytes */
+	char magic[sizeof(BINLOG_MAGIC)];
+	memset(magic, 0, sizeof(magic));
+	const size_t len = fread(magic, 1, sizeof(magic), in);
+	rewind(in);
+	uint32_t pcap_magic = 0;
+	memcpy(&pcap_magic, magic, sizeof(pcap_magic));
+	if (len >= sizeof(pcap_magic)
+	    && (pcap_magic == PCAP_MAGIC_US || pcap_magic == PCAP_MAGIC_NS
+		|| pcap_magic == bswap_32(PCAP_MAGIC_US)
+		|| pcap_magic == bswap_32(PCAP_MAGIC_NS)))
+		convert_pcap(in, &w);
+	else if (len == sizeof(magic)
+		 && memcmp(magic, BINLOG_MAGIC, sizeof(magic)) == 0)
+		convert_binlog(in, &w);
+	else
+		convert_tsv(in, &w);
+	if (ferror(in))
+	{
+		perror("Reading input");
+		exit(EXIT_FILEFAIL);
+	}
+	fclose(in);
+
+	if (fseek(w.out, 0, SEEK_SET) != 0
+	    || fwrite(&(w.hdr), sizeof(w.hdr), 1, w.out) != 1
+	    || fclose(w.out) != 0)
+	{
+		perror("Writing schedule");
+		exit(EXIT_FILEFAIL);
+	}
+	fprintf(stderr, "%" PRIu64 " records, maximum size %u bytes",
+		w.hdr.count, w.hdr.max_size);
+	if (w.skipped > 0)
+		fprintf(stderr, ", %" PRIu64 " non-IP or invalid entries "
+			"skipped", w.skipped);
+	if (w.reordered > 0)
+		fprintf(stderr, ", %" PRIu64 " packets out of order",
+			w.reordered);
+	fprintf(stderr, "\n");
+	return 0;
+}
@@ -34,7 +34,11 @@
 
 #include "luna.h"
 #include "server.h"
+#include "binlog.h"
 #include "client.h"
+#include "protocol.h"
+#include "traffic.h"
+#include "txstamp.h"
 
 /* POSIX requires a minimum range of 32 for priorities. Using the
  * minimum plus 20 seems reasonable to aquire a high priority without
@@ -51,9 +55,29 @@
  * charcodes for short options */
 #define OPT_START_TIME 260
 #define OPT_CLOCK 261
+#define OPT_SEND_MODE 262
+#define OPT_BATCH 263
+#define OPT_LEAD_TIME 264
+#define OPT_SPIN_MARGIN 265
+#define OPT_UNDERRUN 266
+#define OPT_TX_TIMESTAMPS 267
+#define OPT_TX_LOG 268
+#define OPT_OUTPUT_FORMAT 269
+#define OPT_DIRECT_IO 270
+#define OPT_STEER 271
+#define OPT_STATS_INTERVAL 272
+#define OPT_SERVER_STAMPS 273
+#define OPT_PROTOCOL 274
+#define OPT_CLOSED_LOOP 275
+#define OPT_REQUEST_TIMEOUT 276
+#define OPT_SWEEP 277
+#define OPT_SLO_LOSS 278
+#define OPT_SLO_RTT 279
+#define OPT_HUGEPAGES 280
+#define OPT_BUFFER_TIME 281
 
 /* valid command line options for getopt */
-#define CLI_OPTS "sc:p:46Tt:g:a:eo:"
+#define CLI_OPTS "sc:p:46Tt:g:a:eo:j:"
 const struct option long_opts[] = {
 	{"server",	no_argument,		NULL,	's'},
 	{"client",	required_argument,	NULL,	'c'},
@@ -66,8 +90,29 @@ const struct option long_opts[] = {
 	{"generator-args", required_argument,	NULL,	'a'},
 	{"echo",	no_argument,		NULL,	'e'},
 	{"output",	required_argument,	NULL,	'o'},
+	{"threads",	required_argument,	NULL,	'j'},
 	{"start-time",	required_argument,	NULL,	OPT_START_TIME},
 	{"clock",	required_argument,	NULL,	OPT_CLOCK},
+	{"send-mode",	required_argument,	NULL,	OPT_SEND_MODE},
+	{"batch",	required_argument,	NULL,	OPT_BATCH},
+	{"lead-time",	required_argument,	NULL,	OPT_LEAD_TIME},
+	{"spin-margin",	required_argument,	NULL,	OPT_SPIN_MARGIN},
+	{"underrun",	required_argument,	NULL,	OPT_UNDERRUN},
+	{"tx-timestamps", required_argument,	NULL,	OPT_TX_TIMESTAMPS},
+	{"tx-log",	required_argument,	NULL,	OPT_TX_LOG},
+	{"output-format", required_argument,	NULL,	OPT_OUTPUT_FORMAT},
+	{"direct-io",	no_argument,		NULL,	OPT_DIRECT_IO},
+	{"steer",	required_argument,	NULL,	OPT_STEER},
+	{"stats-interval", required_argument,	NULL,	OPT_STATS_INTERVAL},
+	{"server-stamps", no_argument,		NULL,	OPT_SERVER_STAMPS},
+	{"protocol",	required_argument,	NULL,	OPT_PROTOCOL},
+	{"closed-loop",	required_argument,	NULL,	OPT_CLOSED_LOOP},
+	{"request-timeout", required_argument,	NULL,	OPT_REQUEST_TIMEOUT},
+	{"sweep",	required_argument,	NULL,	OPT_SWEEP},
+	{"slo-loss",	required_argument,	NULL,	OPT_SLO_LOSS},
+	{"slo-rtt",	required_argument,	NULL,	OPT_SLO_RTT},
+	{"hugepages",	no_argument,		NULL,	OPT_HUGEPAGES},
+	{"buffer-time",	required_argument,	NULL,	OPT_BUFFER_TIME},
 	{NULL,		0,			NULL,	0}
 };
 
@@ -111,6 +156,21 @@ void touch_page(void *const mem, const size_t size)
 
 
 
+int packet_timestamp(const struct msghdr *const hdr, struct timespec *const ts)
+{
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(hdr); cm != NULL;
+	     cm = CMSG_NXTHDR((struct msghdr *) hdr, cm))
+		if (cm->cmsg_level == SOL_SOCKET
+		    && cm->cmsg_type == SCM_TIMESTAMPNS)
+		{
+			memcpy(ts, CMSG_DATA(cm), sizeof(struct timespec));
+			return 0;
+		}
+	return -1;
+}
+
+
+
 void printtimeres()
 {
 	struct timespec timeres = {0, 0};
@@ -143,11 +203,35 @@ int main(int argc, char *argv[])
 	struct timespec start_time = {0, 0};
 	clockid_t clk_id = CLOCK_MONOTONIC;
 	int echo = 0;
-	/* port, host and clock will be allocated by strdup if needed,
-	 * free'd below. */
+	int server_stamps = 0;
+	int protocol = PROTOCOL_AUTO;
+	int threads = 1;
+	int log_format = LOG_FORMAT_TEXT;
+	int steer = SERVER_STEER_NONE;
+	int stats_interval = 0;
+	int closed_loop = 0;
+	long request_timeout = DEFAULT_REQUEST_TIMEOUT;
+	double sweep_min = 0;
+	double sweep_max = 0;
+	double sweep_step = 0;
+	double slo_loss = DEFAULT_SLO_LOSS;
+	int64_t slo_rtt = 0;
+	int hugepages = 0;
+	int64_t buffer_time = DEFAULT_BUFFER_TIME;
+	int batch = DEFAULT_TXTIME_BATCH;
+	long lead_time = DEFAULT_TXTIME_LEAD;
+	long spin_margin = 0;
+	/* port, host, clock, send mode, underrun policy and transmit
+	 * timestamp mode will be allocated by strdup if needed, free'd
+	 * below. */
 	char *port = NULL;
 	char *host = NULL;
 	char *clock = NULL;
+	char *send_mode = NULL;
+	char *underrun = NULL;
+	char *tx_timestamps = NULL;
+	/* file path to write transmit timestamps to */
+	char *tx_log = NULL;
 	/* the packet generator to use and its arguments */
 	char *generator = NULL;
 	char *gen_args = NULL;
@@ -217,6 +301,9 @@ int main(int argc, char *argv[])
 			datafile = strdup(optarg);
 			CHKALLOC(datafile);
 			break;
+		case 'j': // number of sending or receiving threads
+			threads = atoi(optarg);
+			break;
 		case OPT_START_TIME:
 			start_time.tv_sec = strtoul(optarg, NULL, 10);
 			clk_id = CLOCK_REALTIME;
@@ -226,12 +313,127 @@ int main(int argc, char *argv[])
 			clock = strdup(optarg);
 			CHKALLOC(clock);
 			break;
+		case OPT_SEND_MODE:
+			ASSERT_UNINIT(send_mode, "--send-mode");
+			send_mode = strdup(optarg);
+			CHKALLOC(send_mode);
+			break;
+		case OPT_BATCH:
+			batch = atoi(optarg);
+			break;
+		case OPT_LEAD_TIME:
+			lead_time = atol(optarg) * NS_PER_US;
+			break;
+		case OPT_UNDERRUN:
+			ASSERT_UNINIT(underrun, "--underrun");
+			underrun = strdup(optarg);
+			CHKALLOC(underrun);
+			break;
+		case OPT_OUTPUT_FORMAT:
+			if (strcmp(optarg, "text") == 0)
+				log_format = LOG_FORMAT_TEXT;
+			else if (strcmp(optarg, "binary") == 0)
+				log_format = LOG_FORMAT_BINARY;
+			else if (strcmp(optarg, "none") == 0)
+				log_format = LOG_FORMAT_NONE;
+			else
+			{
+				fprintf(stderr, "Invalid output format: "
+					"\"%s\"!\n", optarg);
+				exit(EXIT_INVALID);
+			}
+			break;
+		case OPT_STEER:
+			if (strcmp(optarg, "none") == 0)
+				steer = SERVER_STEER_NONE;
+			else if (strcmp(optarg, "hash") == 0)
+				steer = SERVER_STEER_HASH;
+			else if (strcmp(optarg, "cpu") == 0)
+				steer = SERVER_STEER_CPU;
+			else
+			{
+				fprintf(stderr, "Invalid steering policy: "
+					"\"%s\"!\n", optarg);
+				exit(EXIT_INVALID);
+			}
+			break;
+		case OPT_DIRECT_IO:
+			flags |= SERVER_DIRECT_IO;
+			break;
+		case OPT_STATS_INTERVAL:
+			stats_interval = atoi(optarg);
+			break;
+		case OPT_SERVER_STAMPS:
+			server_stamps = 1;
+			break;
+		case OPT_PROTOCOL:
+			if (strcmp(optarg, "auto") == 0)
+				protocol = PROTOCOL_AUTO;
+			else if (strcmp(optarg, "1") == 0)
+				protocol = PROTOCOL_V1;
+			else if (strcmp(optarg, "2") == 0)
+				protocol = PROTOCOL_V2;
+			else
+			{
+				fprintf(stderr, "Invalid protocol version: "
+					"\"%s\"!\n", optarg);
+				exit(EXIT_INVALID);
+			}
+			break;
+		case OPT_CLOSED_LOOP:
+			closed_loop = atoi(optarg);
+			break;
+		case OPT_REQUEST_TIMEOUT:
+			request_timeout = atol(optarg) * NS_PER_US * 1000;
+			break;
+		case OPT_SWEEP:
+			/* MIN:MAX or MIN:MAX:STEP */
+			if (sscanf(optarg, "%lf:%lf:%lf", &sweep_min,
+				   &sweep_max, &sweep_step) < 2
+			    || sweep_min <= 0 || sweep_max < sweep_min
+			    || sweep_step < 0)
+			{
+				fprintf(stderr, "Invalid sweep range: "
+					"\"%s\"!\n", optarg);
+				exit(EXIT_INVALID);
+			}
+			break;
+		case OPT_SLO_LOSS:
+			slo_loss = atof(optarg);
+			break;
+		case OPT_SLO_RTT:
+			slo_rtt = atol(optarg) * NS_PER_US;
+			break;
+		case OPT_HUGEPAGES:
+			hugepages = 1;
+			break;
+		case OPT_BUFFER_TIME:
+			buffer_time = atol(optarg) * NS_PER_US * 1000;
+			break;
+		case OPT_TX_TIMESTAMPS:
+			ASSERT_UNINIT(tx_timestamps, "--tx-timestamps");
+			tx_timestamps = strdup(optarg);
+			CHKALLOC(tx_timestamps);
+			break;
+		case OPT_TX_LOG:
+			ASSERT_UNINIT(tx_log, "--tx-log");
+			tx_log = strdup(optarg);
+			CHKALLOC(tx_log);
+			break;
+		case OPT_SPIN_MARGIN:
+			spin_margin = atol(optarg) * NS_PER_US;
+			break;
 		default:
 			break;
 		}
 	}
 
-	if (!(flags & SERVER_TSV_OUTPUT))
+	if (log_format == LOG_FORMAT_BINARY)
+		flags |= SERVER_BINARY_OUTPUT;
+	else if (log_format == LOG_FORMAT_NONE)
+		flags |= SERVER_NO_OUTPUT;
+	/* don't mix human readable output into data on stdout */
+	if (!(flags & (SERVER_TSV_OUTPUT | SERVER_BINARY_OUTPUT)))
 		printtimeres();
 
 	if (port == NULL)
@@ -246,6 +448,14 @@ int main(int argc, char *argv[])
 		generator = strdup(DEFAULT_GENERATOR);
 		CHKALLOC(generator);
 	}
+	/* every sender would play the whole trace, stretched to the
+	 * number of senders */
+	if (client && threads > 1 && strcmp(generator, "replay") == 0)
+	{
+		fprintf(stderr, "The replay generator does not support "
+			"multiple sender threads (-j)!\n");
+		exit(EXIT_INVALID);
+	}
 
 	/* If true, the clock to use was set manually */
 	if (clock != NULL)
@@ -275,6 +485,121 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	int mode = SEND_MODE_SLEEP;
+	if (send_mode != NULL)
+	{
+		if (strcmp(send_mode, "sleep") == 0)
+			mode = SEND_MODE_SLEEP;
+		else if (strcmp(send_mode, "txtime") == 0)
+			mode = SEND_MODE_TXTIME;
+		else if (strcmp(send_mode, "spin") == 0)
+			mode = SEND_MODE_SPIN;
+		else
+		{
+			fprintf(stderr, "Invalid send mode: \"%s\"!\n",
+				send_mode);
+			exit(EXIT_INVALID);
+		}
+		free(send_mode);
+	}
+	int underrun_policy = UNDERRUN_STALL;
+	if (underrun != NULL)
+	{
+		if (strcmp(underrun, "stall") == 0)
+			underrun_policy = UNDERRUN_STALL;
+		else if (strcmp(underrun, "repeat") == 0)
+			underrun_policy = UNDERRUN_REPEAT;
+		else if (strcmp(underrun, "abort") == 0)
+			underrun_policy = UNDERRUN_ABORT;
+		else
+		{
+			fprintf(stderr, "Invalid underrun policy: \"%s\"!\n",
+				underrun);
+			exit(EXIT_INVALID);
+		}
+		free(underrun);
+	}
+	int txstamp_mode = TXSTAMP_NONE;
+	if (tx_timestamps != NULL)
+	{
+		if (strcmp(tx_timestamps, "software") == 0)
+			txstamp_mode = TXSTAMP_SOFTWARE;
+		else if (strcmp(tx_timestamps, "hardware") == 0)
+			txstamp_mode = TXSTAMP_HARDWARE;
+		else
+		{
+			fprintf(stderr, "Invalid transmit timestamp mode: "
+				"\"%s\"!\n", tx_timestamps);
+			exit(EXIT_INVALID);
+		}
+		free(tx_timestamps);
+		if (tx_log == NULL)
+		{
+			fprintf(stderr, "Transmit timestamps require a log "
+				"file (--tx-log)!\n");
+			exit(EXIT_INVALID);
+		}
+	}
+	if (log_format == LOG_FORMAT_NONE && !server)
+	{
+		fprintf(stderr, "Output format \"none\" is only supported "
+			"in server mode!\n");
+		exit(EXIT_INVALID);
+	}
+	if (server_stamps && !echo)
+	{
+		fprintf(stderr, "Server timestamps require echo mode "
+			"(-e)!\n");
+		exit(EXIT_INVALID);
+	}
+	if (closed_loop < 0 || request_timeout <= 0)
+	{
+		fprintf(stderr, "The number of closed-loop requests must not "
+			"be negative, the request timeout must be "
+			"positive!\n");
+		exit(EXIT_INVALID);
+	}
+	if (closed_loop > 0 && (!echo || mode != SEND_MODE_SLEEP))
+	{
+		fprintf(stderr, "Closed-loop mode requires echo mode (-e) "
+			"and send mode \"sleep\"!\n");
+		exit(EXIT_INVALID);
+	}
+	if (sweep_min > 0 && (!echo || closed_loop > 0))
+	{
+		fprintf(stderr, "A rate sweep requires echo mode (-e) and "
+			"does not work in closed-loop mode!\n");
+		exit(EXIT_INVALID);
+	}
+	if (buffer_time <= 0)
+	{
+		fprintf(stderr, "The buffer time must be positive!\n");
+		exit(EXIT_INVALID);
+	}
+	if (slo_loss < 0 || slo_rtt < 0)
+	{
+		fprintf(stderr, "Loss and RTT objectives must not be "
+			"negative!\n");
+		exit(EXIT_INVALID);
+	}
+	if (stats_interval < 0)
+	{
+		fprintf(stderr, "The statistics interval must not be "
+			"negative!\n");
+		exit(EXIT_INVALID);
+	}
+	if (threads < 1)
+	{
+		fprintf(stderr, "The number of threads must be positive!\n");
+		exit(EXIT_INVALID);
+	}
+	if (batch < 1 || lead_time < 0 || spin_margin < 0)
+	{
+		fprintf(stderr, "Batch size must be positive, lead time and "
+			"spin margin must not be negative!\n");
+		exit(EXIT_INVALID);
+	}
+
 	if (server)
 	{
 		addrhints.ai_flags |= AI_PASSIVE;
@@ -332,16 +657,54 @@ int main(int argc, char *argv[])
 	}
 
 	if (client)
-		retval = run_client(res, time,
-				    start_time, clk_id,
-				    echo,
-				    generator, gen_args,
-				    datafile);
+	{
+		const struct client_config config = {
+			.time = time,
+			.start_time = start_time,
+			.clk_id = clk_id,
+			.echo = echo,
+			.server_stamps = server_stamps,
+			.generator_type = generator,
+			.generator_args = gen_args,
+			.datafile = datafile,
+			.send_mode = mode,
+			.threads = threads,
+			.underrun = underrun_policy,
+			.batch = batch,
+			.lead_time = lead_time,
+			.spin_margin = spin_margin,
+			.tx_timestamps = txstamp_mode,
+			.tx_log = tx_log,
+			.protocol = protocol,
+			.log_format = log_format,
+			.stats_interval = stats_interval,
+			.closed_loop = closed_loop,
+			.request_timeout = request_timeout,
+			.sweep_min = sweep_min,
+			.sweep_max = sweep_max,
+			.sweep_step = sweep_step,
+			.slo_loss = slo_loss,
+			.slo_rtt = slo_rtt,
+			.hugepages = hugepages,
+			.buffer_time = buffer_time
+		};
+		retval = run_client(res, &config);
+	}
 	free(gen_args);
 	free(generator);
+	free(tx_log);
 
 	if (server)
-		retval = run_server(res, flags, datafile);
+	{
+		const struct server_config config = {
+			.flags = flags,
+			.datafile = datafile,
+			.threads = threads,
+			.steer = steer,
+			.stats_interval = stats_interval
+		};
+		retval = run_server(res, &config);
+	}
 	free(datafile);
 
 	return retval;
@@ -19,8 +19,11 @@
 #ifndef __LUNA_LUNA_H__
 #define __LUNA_LUNA_H__
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
 
 /* default server port (can be changed by -p command line argument),
  * and it's length (ASCII bytes including terminating null byte) */
@@ -47,23 +50,41 @@
 #define NS_PER_US 1000
 
 /*
- * Minimum packet size as required for our payload. Larger sizes are
- * possible as long as the UDP stacks permits them. Current content of
- * the LUNA protocol header:
+ * LUNA protocol headers, see protocol.h for the details and the
+ * functions to read and write them. Version 1:
  *
  * int: sequence number
  * struct timespec: clock time recorded right before sending
  * char: flags byte
  *
- * The two timespec struct components are defined to always be 8 byte
- * each, so this is platform independent.
+ * Version 2 uses explicit byte order, a 64 bit sequence number and a
+ * flow ID, and is 24 bytes long. The flags byte is at the same
+ * position in both versions, LUNA_FLAG_V2 tells them apart.
+ *
+ * Packets always have at least MIN_PACKET_SIZE bytes, enough for
+ * either header. Larger sizes are possible as long as the UDP stacks
+ * permits them.
  */
-#define MIN_PACKET_SIZE (sizeof(int) + sizeof(struct timespec) + sizeof(char))
+#define PROTOCOL_V1_HEADER_SIZE						\
+	(sizeof(int) + sizeof(struct timespec) + sizeof(char))
+#define PROTOCOL_V2_HEADER_SIZE 24
+#define MIN_PACKET_SIZE PROTOCOL_V2_HEADER_SIZE
+/* position of the flags byte in the packet */
+#define PACKET_FLAGS_OFFSET (sizeof(int) + sizeof(struct timespec))
 /* set in flags byte to request a response from the server */
 #define LUNA_FLAG_ECHO 1
+/* set in flags byte to request server timestamps in the response */
+#define LUNA_FLAG_STAMPS 2
+/* protocol version negotiation packet, see protocol.h */
+#define LUNA_FLAG_HELLO 64
+/* set in flags byte for protocol version 2 and later */
+#define LUNA_FLAG_V2 128
 
 /* size of the buffer for one message */
 #define MSG_BUF_SIZE 1500
+/* size of the control message buffer for one received packet, enough
+ * for the SO_TIMESTAMPNS receive timestamp */
+#define RECV_CMSG_SIZE CMSG_SPACE(sizeof(struct timespec))
 /* size of the buffer for one sockaddr struct (IPv6 sockaddr is the
  * largest one we should expect) */
 #define ADDRBUF_SIZE (sizeof(struct sockaddr_in6))
@@ -96,6 +117,19 @@ void chkalloc(void *const ptr, const char *const file, const int line);
 		}							\
 	} while (0)
 
+/* Convert a struct timespec to nanoseconds */
+static inline int64_t timespec_to_ns(const struct timespec *const ts)
+{
+	return (int64_t) ts->tv_sec * NS_PER_S + ts->tv_nsec;
+}
+
+/* Convert nanoseconds (non-negative) to a struct timespec */
+static inline void ns_to_timespec(const int64_t ns, struct timespec *const ts)
+{
+	ts->tv_sec = ns / NS_PER_S;
+	ts->tv_nsec = ns % NS_PER_S;
+}
+
 /* buffer size for time strings (%T or %s of strftime, with some room
  * to spare for the latter) */
 #define T_TIME_BUF 16
@@ -109,4 +143,9 @@ int check_pfaults(const struct rusage *const pre,
  * for passing the correct size. */
 void touch_page(void *const mem, const size_t size);
 
+/* Get the kernel receive timestamp from the control messages of a
+ * packet received on a socket with SO_TIMESTAMPNS enabled. Returns 0
+ * on success, -1 if the packet has no timestamp. */
+int packet_timestamp(const struct msghdr *const hdr, struct timespec *const ts);
+
 #endif /* __LUNA_LUNA_H__ */
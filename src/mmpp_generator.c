@@ -0,0 +1,460 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "luna.h"
+#include "distribution.h"
+#include "mmpp_generator.h"
+#include "rng.h"
+
+/* default maximum packet size if no size distribution has an upper
+ * bound (bytes) */
+#define DEFAULT_MAX_SIZE MSG_BUF_SIZE
+/* default mean time spent in a state (µs) */
+#define DEFAULT_DWELL 10000.0
+
+int mmpp_generator_init(generator_t *this);
+int mmpp_generator_fill_block(generator_t *this,
+			      struct packet_block *current);
+int mmpp_generator_destroy(generator_t *this);
+
+struct mmpp_state
+{
+	/* packet interval (µs) and size (bytes) distributions */
+	struct distribution interval;
+	struct distribution size;
+	/* no packets are sent in this state */
+	int off;
+	/* mean time spent in the state (ns), exponentially
+	 * distributed */
+	double dwell;
+	/* cumulative probabilities of the next state */
+	double next[MMPP_MAX_STATES];
+};
+
+/* Values of a distribution, drawn a batch at a time and used one by
+ * one by the state machine */
+struct mmpp_pool
+{
+	const struct distribution *dist;
+	double *values;
+	/* index of the next unused value */
+	int next;
+};
+
+struct mmpp_generator_attr
+{
+	int count;
+	struct mmpp_state states[MMPP_MAX_STATES];
+	/* current state, time left in it and time since the last
+	 * packet (ns) */
+	int current;
+	double left;
+	double gap;
+	struct rng rng;
+	/* number of values drawn at once (the block length), and the
+	 * pools of packet intervals and sizes of each state, of the
+	 * uniform values choosing the next state and of the dwell
+	 * times (mean 1) */
+	int batch;
+	struct mmpp_pool intervals[MMPP_MAX_STATES];
+	struct mmpp_pool sizes[MMPP_MAX_STATES];
+	struct mmpp_pool transitions;
+	struct mmpp_pool dwells;
+};
+
+/* sources of the transition and dwell time pools */
+static const struct distribution unit_uniform = {DIST_UNIFORM, 0, 1};
+static const struct distribution unit_exponential = {DIST_EXPONENTIAL, 1, 0};
+
+
+
+/* If name is prefix followed by a state number, return the number,
+ * -1 otherwise. Exits if there is no such state. */
+static int state_arg(const char *const name, const char *const prefix,
+		     const int count)
+{
+	const size_t len = strlen(prefix);
+	if (strncmp(name, prefix, len) != 0 || !isdigit(name[len]))
+		return -1;
+	char *end = NULL;
+	const long s = strtol(name + len, &end, 10);
+	if (*end != '\0')
+		return -1;
+	if (s >= count)
+	{
+		fprintf(stderr, "ERROR: Argument %s refers to state %ld, but "
+			"there are only %i states!\n", name, s, count);
+		exit(EXIT_INVALID);
+	}
+	return (int) s;
+}
+
+
+
+/* Parse a distribution, exits if it is invalid */
+static void parse_dist(const char *const name, const char *const value,
+		       struct distribution *const dist)
+{
+	if (distribution_parse(value, dist) != 0)
+	{
+		fprintf(stderr, "ERROR: Invalid distribution for %s: "
+			"\"%s\"!\n", name, value);
+		exit(EXIT_INVALID);
+	}
+}
+
+
+
+/* Parse a row of the transition matrix "p0:p1:..." into cumulative
+ * probabilities, exits if it is invalid. The probability to stay in
+ * the same state is ignored. */
+static void parse_next(const char *const name, const char *const value,
+		       const int self, const int count, double *const next)
+{
+	const char *p = value;
+	double sum = 0;
+	for (int i = 0; i < count; i++)
+	{
+		char *end = NULL;
+		double v = strtod(p, &end);
+		if (end == p || v < 0 || (*end != ':' && i < count - 1))
+		{
+			fprintf(stderr, "ERROR: %s needs %i probabilities "
+				"separated by \":\", got \"%s\"!\n",
+				name, count, value);
+			exit(EXIT_INVALID);
+		}
+		p = end + 1;
+		if (i == self)
+			v = 0;
+		sum += v;
+		next[i] = sum;
+	}
+	if (sum <= 0)
+	{
+		fprintf(stderr, "ERROR: %s has no transition to another "
+			"state!\n", name);
+		exit(EXIT_INVALID);
+	}
+	for (int i = 0; i < count; i++)
+		next[i] /= sum;
+}
+
+
+
+/*
+ * Create the generator. The parameters are taken from args. If args
+ * is NULL, or a parameter is missing, default values will be used.
+ * N stands for the number of a state, counting from 0.
+ *
+ * states: number of states, default 2
+ * intervalN: distribution of the packet intervals in state N (µs),
+ *	      or "off" for no packets, default constant:1000
+ * sizeN: distribution of the packet sizes in state N (bytes),
+ *	  default the minimum size
+ * dwellN: mean time spent in state N (µs), default DEFAULT_DWELL
+ * nextN: probabilities of switching from state N to each state,
+ *	  separated by ":", default equal for all other states
+ * max (m): maximum packet size, larger values are replaced with it
+ * seed: seed for the random number generator
+ */
+int mmpp_generator_create(generator_t *this, generator_option *args)
+{
+	this->init_generator = &mmpp_generator_init;
+	this->fill_block = &mmpp_generator_fill_block;
+	this->destroy_generator = &mmpp_generator_destroy;
+
+	this->attr = calloc(1, sizeof(struct mmpp_generator_attr));
+	CHKALLOC(this->attr);
+	struct mmpp_generator_attr *attr =
+		(struct mmpp_generator_attr *) this->attr;
+	attr->count = 2;
+	int max = 0;
+	unsigned long seed = RNG_DEFAULT_SEED;
+
+	/* the number of states is needed to check the others */
+	for (int i = 0; args != NULL && args[i].name != NULL; i++)
+		if (strcmp(args[i].name, "states") == 0)
+			attr->count = atoi(args[i].value);
+	if (attr->count < 1 || attr->count > MMPP_MAX_STATES)
+	{
+		fprintf(stderr, "ERROR: The number of states must be "
+			"between 1 and %i!\n", MMPP_MAX_STATES);
+		exit(EXIT_INVALID);
+	}
+	for (int s = 0; s < attr->count; s++)
+	{
+		struct mmpp_state *const state = &(attr->states[s]);
+		const struct distribution interval = {DIST_CONSTANT, 1000, 0};
+		const struct distribution size =
+			{DIST_CONSTANT, MIN_PACKET_SIZE, 0};
+		state->interval = interval;
+		state->size = size;
+		state->dwell = DEFAULT_DWELL * NS_PER_US;
+		for (int i = 0; i < attr->count; i++)
+			state->next[i] = attr->count == 1 ? 1.0 :
+				(double) (i < s ? i + 1 : i)
+				/ (attr->count - 1);
+	}
+
+	for (int i = 0; args != NULL && args[i].name != NULL; i++)
+	{
+		char *name = args[i].name;
+		char *value = args[i].value;
+		const int count = attr->count;
+		int s;
+		if ((s = state_arg(name, "interval", count)) >= 0)
+		{
+			attr->states[s].off = strcmp(value, "off") == 0;
+			if (!attr->states[s].off)
+				parse_dist(name, value,
+					   &(attr->states[s].interval));
+		}
+		else if ((s = state_arg(name, "size", count)) >= 0)
+			parse_dist(name, value, &(attr->states[s].size));
+		else if ((s = state_arg(name, "dwell", count)) >= 0)
+			attr->states[s].dwell = atof(value) * NS_PER_US;
+		else if ((s = state_arg(name, "next", count)) >= 0)
+			parse_next(name, value, s, count,
+				   attr->states[s].next);
+		else if (strcmp(name, "max") == 0 || strcmp(name, "m") == 0)
+			max = atoi(value);
+		else if (strcmp(name, "seed") == 0)
+			seed = strtoul(value, NULL, 10);
+		/* handled above */
+		else if (strcmp(name, "states") != 0)
+		{
+			fprintf(stderr, "ERROR: Unknown argument \"%s\" for "
+				"the mmpp generator!\n", name);
+			exit(EXIT_INVALID);
+		}
+	}
+
+	/* the largest bound of all size distributions */
+	int on = 0;
+	double bound = 0;
+	for (int s = 0; s < attr->count; s++)
+	{
+		const double b = distribution_bound(&(attr->states[s].size),
+						    DEFAULT_MAX_SIZE);
+		if (b > bound)
+			bound = b;
+		if (attr->states[s].dwell <= 0)
+		{
+			fprintf(stderr, "ERROR: The dwell time of state %i "
+				"must be positive!\n", s);
+			exit(EXIT_INVALID);
+		}
+		if (!attr->states[s].off)
+			on = 1;
+	}
+	if (!on)
+	{
+		fprintf(stderr, "ERROR: At least one state must send "
+			"packets!\n");
+		exit(EXIT_INVALID);
+	}
+	if (max <= 0)
+		max = (int) ceil(bound);
+	if (max < MIN_PACKET_SIZE)
+		max = MIN_PACKET_SIZE;
+	this->max_size = max;
+
+	rng_seed(&(attr->rng), seed, this->id);
+
+	return 0;
+}
+
+
+
+/* Take the next value from the pool, drawing a new batch if it is
+ * used up */
+static double pool_next(struct mmpp_generator_attr *const attr,
+			struct mmpp_pool *const pool)
+{
+	if (pool->next == attr->batch)
+	{
+		distribution_sample_batch(pool->dist, &(attr->rng),
+					  pool->values, attr->batch);
+		pool->next = 0;
+	}
+	return pool->values[pool->next++];
+}
+
+
+
+/* Switch to the next state of the Markov chain */
+static void next_state(struct mmpp_generator_attr *const attr)
+{
+	const struct mmpp_state *const state = &(attr->states[attr->current]);
+	if (attr->count > 1)
+	{
+		const double u = pool_next(attr, &(attr->transitions));
+		int next = 0;
+		while (next < attr->count - 1 && u >= state->next[next])
+			next++;
+		attr->current = next;
+	}
+	attr->left = pool_next(attr, &(attr->dwells))
+		* attr->states[attr->current].dwell;
+}
+
+
+
+/* Set up a pool for dist, the first value taken draws a batch */
+static void pool_init(struct mmpp_pool *const pool,
+		      const struct distribution *const dist,
+		      double *const values, const int batch)
+{
+	pool->dist = dist;
+	pool->values = values;
+	pool->next = batch;
+}
+
+
+
+int mmpp_generator_init(generator_t *this)
+{
+	struct mmpp_generator_attr *attr =
+		(struct mmpp_generator_attr *) this->attr;
+
+	/* size the blocks for the state with the shortest mean
+	 * interval, bursts must not drain the buffer */
+	double interval = 0;
+	for (int i = 0; i < attr->count; i++)
+	{
+		const double mean =
+			distribution_mean(&(attr->states[i].interval));
+		if (!attr->states[i].off && mean > 0
+		    && (interval == 0 || mean < interval))
+			interval = mean;
+	}
+	this->block = create_sized_block_circle(this, interval * NS_PER_US);
+
+	/* one batch of values for each pool, in a single buffer */
+	const int batch = this->block->length;
+	double *const values =
+		malloc((2 * attr->count + 2) * batch * sizeof(double));
+	CHKALLOC(values);
+	attr->batch = batch;
+	for (int i = 0; i < attr->count; i++)
+	{
+		pool_init(&(attr->intervals[i]), &(attr->states[i].interval),
+			  values + 2 * i * batch, batch);
+		pool_init(&(attr->sizes[i]), &(attr->states[i].size),
+			  values + (2 * i + 1) * batch, batch);
+	}
+	pool_init(&(attr->transitions), &unit_uniform,
+		  values + 2 * attr->count * batch, batch);
+	pool_init(&(attr->dwells), &unit_exponential,
+		  values + (2 * attr->count + 1) * batch, batch);
+
+	/* start in state 0 */
+	attr->current = 0;
+	attr->gap = 0;
+	attr->left = pool_next(attr, &(attr->dwells)) * attr->states[0].dwell;
+
+	struct packet_block *block = this->block;
+	do
+	{
+		mmpp_generator_fill_block(this, block);
+		block = block->next;
+	} while (block != this->block);
+
+	return 0;
+}
+
+
+
+/*
+ * Refill the block. The interval to the next packet is drawn from
+ * the distribution of the current state. If the state ends before
+ * the packet is due, the rest of the state's time is added to the
+ * gap and the interval is drawn again in the next state, which is
+ * exact for exponential intervals (Poisson traffic in each state).
+ * All random values come from the pools, which are refilled by the
+ * batch transforms of distribution.h.
+ */
+int mmpp_generator_fill_block(generator_t *this,
+			      struct packet_block *current)
+{
+	struct mmpp_generator_attr *attr =
+		(struct mmpp_generator_attr *) this->attr;
+
+	for (int i = 0; i < current->length; i++)
+	{
+		int s;
+		while (1)
+		{
+			s = attr->current;
+			if (!attr->states[s].off)
+			{
+				double d = pool_next(attr,
+						     &(attr->intervals[s]))
+					* NS_PER_US;
+				if (d < 0)
+					d = 0;
+				if (d <= attr->left)
+				{
+					attr->left -= d;
+					attr->gap += d;
+					break;
+				}
+			}
+			attr->gap += attr->left;
+			next_state(attr);
+		}
+		/* clamp before rounding, huge values would overflow */
+		ns_to_timespec(attr->gap < GENERATOR_MAX_DELAY ?
+			       llround(attr->gap) : GENERATOR_MAX_DELAY,
+			       &(current->data[i].delay));
+		attr->gap = 0;
+		const double size = pool_next(attr, &(attr->sizes[s]));
+		if (!(size >= MIN_PACKET_SIZE))
+			current->data[i].size = MIN_PACKET_SIZE;
+		else if (size > this->max_size)
+			current->data[i].size = this->max_size;
+		else
+			current->data[i].size = lround(size);
+	}
+
+	return 0;
+}
+
+
+
+int mmpp_generator_destroy(generator_t *this)
+{
+	struct mmpp_generator_attr *attr =
+		(struct mmpp_generator_attr *) this->attr;
+	int ret = 0;
+
+	ret = destroy_block_circle(this->block); // pass error, if any
+	this->block = NULL;
+	/* all pools share the buffer of the first one */
+	free(attr->intervals[0].values);
+	free(this->attr);
+	return ret;
+}
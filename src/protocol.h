@@ -0,0 +1,266 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_PROTOCOL_H__
+#define __LUNA_PROTOCOL_H__
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "luna.h"
+
+/*
+ * Protocol versions. Version 1 is the original header (see luna.h),
+ * with the sequence number in network byte order, but the send time
+ * as a struct timespec in host byte order.
+ *
+ * Version 2, all fields in network byte order (big endian):
+ *
+ * offset 0, uint32: lower 32 bits of the sequence number
+ * offset 4, int64: send time (ns, CLOCK_REALTIME)
+ * offset 12, uint32: upper 32 bits of the sequence number
+ * offset 16, uint32: flow ID, chosen by the client (the sender thread)
+ * offset 20, uint8: flags byte, with LUNA_FLAG_V2 set
+ * offset 21, uint8: protocol version
+ * offset 22, uint16: header length including extensions
+ *
+ * Sequence number and flags are where version 1 has them, so servers
+ * that only know version 1 still log sequence numbers (modulo 2^32)
+ * and echo packets correctly. Receivers skip header extensions they
+ * don't know using the header length.
+ *
+ * Server timestamps (LUNA_FLAG_STAMPS) follow the header: the kernel
+ * receive time and the send time of the echo at the server, as
+ * struct timespec in version 1 and int64 ns in version 2.
+ *
+ * Negotiation: Before sending, the client sends a version 1 packet
+ * with sequence number -1 and the LUNA_FLAG_HELLO and LUNA_FLAG_ECHO
+ * flags. Servers supporting version 2 reply with a version 2 header
+ * with LUNA_FLAG_HELLO set and the highest version they support, and
+ * don't log the packet. Older servers echo the packet unchanged, so
+ * the reply has no LUNA_FLAG_V2 flag.
+ */
+#define PROTOCOL_AUTO 0
+#define PROTOCOL_V1 1
+#define PROTOCOL_V2 2
+/* highest version supported */
+#define PROTOCOL_VERSION PROTOCOL_V2
+
+/* positions of the version 2 header fields */
+#define V2_SEQ_LOW_OFFSET 0
+#define V2_TIME_OFFSET 4
+#define V2_SEQ_HIGH_OFFSET 12
+#define V2_FLOW_OFFSET 16
+#define V2_VERSION_OFFSET 21
+#define V2_LENGTH_OFFSET 22
+
+/* sequence number of negotiation packets */
+#define PROTOCOL_HELLO_SEQ -1
+/* number of negotiation packets the client sends before falling
+ * back to version 1, and how long it waits for a reply to each (ms) */
+#define PROTOCOL_HELLO_TRIES 5
+#define PROTOCOL_HELLO_TIMEOUT 200
+
+/* header fields, independent of the version */
+struct packet_header
+{
+	int64_t sequence;
+	/* send time (ns, CLOCK_REALTIME) */
+	int64_t send_time;
+	uint32_t flow;
+	uint8_t flags;
+	uint8_t version;
+	/* header length, server timestamps start here */
+	uint16_t length;
+};
+
+
+
+static inline uint32_t get_be32(const char *const buf)
+{
+	uint32_t v;
+	memcpy(&v, buf, sizeof(v));
+	return ntohl(v);
+}
+
+
+
+static inline void put_be32(char *const buf, const uint32_t value)
+{
+	const uint32_t v = htonl(value);
+	memcpy(buf, &v, sizeof(v));
+}
+
+
+
+static inline int64_t get_be64(const char *const buf)
+{
+	uint64_t v;
+	memcpy(&v, buf, sizeof(v));
+	return (int64_t) be64toh(v);
+}
+
+
+
+static inline void put_be64(char *const buf, const int64_t value)
+{
+	const uint64_t v = htobe64((uint64_t) value);
+	memcpy(buf, &v, sizeof(v));
+}
+
+
+
+/* Read the header of a received packet of len bytes. Returns 0 on
+ * success, -1 if the packet is too short for its header. */
+static inline int packet_read_header(const char *const buf, const ssize_t len,
+				     struct packet_header *const hdr)
+{
+	if (len < (ssize_t) PROTOCOL_V1_HEADER_SIZE)
+		return -1;
+	hdr->flags = buf[PACKET_FLAGS_OFFSET];
+	if (!(hdr->flags & LUNA_FLAG_V2))
+	{
+		struct timespec ts;
+		memcpy(&ts, buf + sizeof(int), sizeof(ts));
+		hdr->sequence = (int32_t) get_be32(buf);
+		hdr->send_time = timespec_to_ns(&ts);
+		hdr->flow = 0;
+		hdr->version = PROTOCOL_V1;
+		hdr->length = PROTOCOL_V1_HEADER_SIZE;
+		return 0;
+	}
+	if (len < PROTOCOL_V2_HEADER_SIZE)
+		return -1;
+	hdr->sequence = (int64_t) (((uint64_t) get_be32(buf + V2_SEQ_HIGH_OFFSET)
+				    << 32) | get_be32(buf + V2_SEQ_LOW_OFFSET));
+	hdr->send_time = get_be64(buf + V2_TIME_OFFSET);
+	hdr->flow = get_be32(buf + V2_FLOW_OFFSET);
+	hdr->version = buf[V2_VERSION_OFFSET];
+	uint16_t length;
+	memcpy(&length, buf + V2_LENGTH_OFFSET, sizeof(length));
+	hdr->length = ntohs(length);
+	if (hdr->length < PROTOCOL_V2_HEADER_SIZE || hdr->length > len)
+		return -1;
+	return 0;
+}
+
+
+
+/* Set the sequence number in a packet header of the given version */
+static inline void packet_set_sequence(char *const buf, const int version,
+				       const int64_t seq)
+{
+	put_be32(buf + V2_SEQ_LOW_OFFSET, (uint32_t) seq);
+	if (version >= PROTOCOL_V2)
+		put_be32(buf + V2_SEQ_HIGH_OFFSET, (uint64_t) seq >> 32);
+}
+
+
+
+/* Set the send time (ns) in a packet header of the given version */
+static inline void packet_set_time(char *const buf, const int version,
+				   const int64_t ns)
+{
+	if (version >= PROTOCOL_V2)
+		put_be64(buf + V2_TIME_OFFSET, ns);
+	else
+	{
+		struct timespec ts;
+		ns_to_timespec(ns, &ts);
+		memcpy(buf + sizeof(int), &ts, sizeof(ts));
+	}
+}
+
+
+
+/* Write a complete header of hdr->version, the buffer must have room
+ * for hdr->length bytes. LUNA_FLAG_V2 is set as needed. */
+static inline void packet_write_header(char *const buf,
+				       const struct packet_header *const hdr)
+{
+	packet_set_sequence(buf, hdr->version, hdr->sequence);
+	packet_set_time(buf, hdr->version, hdr->send_time);
+	if (hdr->version >= PROTOCOL_V2)
+	{
+		put_be32(buf + V2_FLOW_OFFSET, hdr->flow);
+		buf[PACKET_FLAGS_OFFSET] = hdr->flags | LUNA_FLAG_V2;
+		buf[V2_VERSION_OFFSET] = hdr->version;
+		const uint16_t length = htons(hdr->length);
+		memcpy(buf + V2_LENGTH_OFFSET, &length, sizeof(length));
+	}
+	else
+		buf[PACKET_FLAGS_OFFSET] = hdr->flags & ~LUNA_FLAG_V2;
+}
+
+
+
+/* Size of one server timestamp in a packet with the given header */
+static inline size_t packet_stamp_size(const struct packet_header *const hdr)
+{
+	return hdr->version >= PROTOCOL_V2 ?
+		sizeof(int64_t) : sizeof(struct timespec);
+}
+
+
+
+/* Minimum size of a packet that can carry server timestamps */
+static inline ssize_t packet_stamped_size(const struct packet_header *const hdr)
+{
+	return hdr->length + 2 * packet_stamp_size(hdr);
+}
+
+
+
+/* Write server timestamp i (0 for the receive time, 1 for the send
+ * time, ns) into a packet, which must be at least
+ * packet_stamped_size() bytes long */
+static inline void packet_write_stamp(char *const buf,
+				      const struct packet_header *const hdr,
+				      const int i, const int64_t ns)
+{
+	char *const pos = buf + hdr->length + i * packet_stamp_size(hdr);
+	if (hdr->version >= PROTOCOL_V2)
+		put_be64(pos, ns);
+	else
+	{
+		struct timespec ts;
+		ns_to_timespec(ns, &ts);
+		memcpy(pos, &ts, sizeof(ts));
+	}
+}
+
+
+
+/* Read server timestamp i (see packet_write_stamp) from a packet */
+static inline int64_t packet_read_stamp(const char *const buf,
+					const struct packet_header *const hdr,
+					const int i)
+{
+	const char *const pos = buf + hdr->length + i * packet_stamp_size(hdr);
+	if (hdr->version >= PROTOCOL_V2)
+		return get_be64(pos);
+	struct timespec ts;
+	memcpy(&ts, pos, sizeof(ts));
+	return timespec_to_ns(&ts);
+}
+
+#endif /* __LUNA_PROTOCOL_H__ */
@@ -0,0 +1,283 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "luna.h"
+#include "replay_generator.h"
+#include "schedule.h"
+
+/* Number of records at the start of the schedule used to estimate
+ * the mean packet interval the ring is sized for */
+#define REPLAY_SAMPLE 65536
+/* Size of the part of the schedule file mapped at a time (bytes).
+ * LUNA locks all its memory (mlockall with MCL_FUTURE), so mapping
+ * the whole file would load it into RAM. */
+#define REPLAY_WINDOW (16 * 1024 * 1024)
+
+int replay_generator_init(generator_t *this);
+int replay_generator_fill_block(generator_t *this,
+				struct packet_block *current);
+int replay_generator_destroy(generator_t *this);
+
+struct replay_generator_attr
+{
+	int fd;
+	uint64_t file_size;
+	struct schedule_header hdr;
+	/* remaining number of times to play the schedule, 0 for
+	 * endless */
+	uint32_t loops;
+	/* index of the next record */
+	uint64_t next;
+	/* currently mapped part of the file, and the records in it:
+	 * records first to first + len - 1 are at records */
+	void *map;
+	size_t map_len;
+	const struct schedule_record *records;
+	uint64_t first;
+	uint64_t len;
+	/* delay of records without packet, added to the next
+	 * packet (ns) */
+	int64_t pending;
+	/* length of the blocks, the last one of the schedule is
+	 * shortened */
+	int block_len;
+};
+
+
+
+/*
+ * Create the generator. The parameters are taken from args.
+ *
+ * file (f): schedule file to replay, required
+ * loops (l): how often to play the schedule, 0 for endless. Defaults
+ *	      to the value in the file.
+ */
+int replay_generator_create(generator_t *this, generator_option *args)
+{
+	this->init_generator = &replay_generator_init;
+	this->fill_block = &replay_generator_fill_block;
+	this->destroy_generator = &replay_generator_destroy;
+
+	this->attr = calloc(1, sizeof(struct replay_generator_attr));
+	CHKALLOC(this->attr);
+	struct replay_generator_attr *attr =
+		(struct replay_generator_attr *) this->attr;
+	const char *file = NULL;
+	long loops = -1;
+
+	if (args != NULL)
+	{
+		for (int i = 0; args[i].name != NULL; i++)
+		{
+			char *name = args[i].name;
+			char *value = args[i].value;
+			if (strcmp(name, "file") == 0
+			    || strcmp(name, "f") == 0)
+				file = value;
+			else if (strcmp(name, "loops") == 0
+				 || strcmp(name, "l") == 0)
+				loops = atol(value);
+			else
+			{
+				fprintf(stderr, "ERROR: Unknown argument "
+					"\"%s\" for the replay generator!\n",
+					name);
+				exit(EXIT_INVALID);
+			}
+		}
+	}
+	if (file == NULL)
+	{
+		fprintf(stderr, "ERROR: The replay generator requires a "
+			"schedule file (argument \"file\")!\n");
+		exit(EXIT_INVALID);
+	}
+
+	attr->fd = open(file, O_RDONLY);
+	struct stat st;
+	if (attr->fd == -1 || fstat(attr->fd, &st) != 0)
+	{
+		perror("Opening schedule file");
+		exit(EXIT_FILEFAIL);
+	}
+	attr->file_size = st.st_size;
+	if (pread(attr->fd, &(attr->hdr), sizeof(struct schedule_header), 0)
+	    != sizeof(struct schedule_header)
+	    || schedule_check_header(&(attr->hdr), attr->file_size) != 0)
+	{
+		fprintf(stderr, "ERROR: Invalid schedule file \"%s\"!\n",
+			file);
+		exit(EXIT_FILEFAIL);
+	}
+	/* records without packet don't count towards max_size */
+	if (attr->hdr.max_size == 0)
+	{
+		fprintf(stderr, "ERROR: Schedule file \"%s\" contains no "
+			"packets!\n", file);
+		exit(EXIT_INVALID);
+	}
+	attr->loops = loops >= 0 ? (uint32_t) loops : attr->hdr.loops;
+
+	this->max_size = attr->hdr.max_size;
+	if (this->max_size < MIN_PACKET_SIZE)
+		this->max_size = MIN_PACKET_SIZE;
+	return 0;
+}
+
+
+
+/* Map the part of the schedule file starting with record index */
+static void map_window(struct replay_generator_attr *const attr,
+		       const uint64_t index)
+{
+	static long page_size = 0;
+	if (page_size == 0)
+		page_size = sysconf(_SC_PAGESIZE);
+
+	if (attr->map != NULL)
+		munmap(attr->map, attr->map_len);
+	const uint64_t pos = sizeof(struct schedule_header)
+		+ index * sizeof(struct schedule_record);
+	const uint64_t offset = pos - pos % page_size;
+	attr->map_len = attr->file_size - offset < REPLAY_WINDOW ?
+		attr->file_size - offset : REPLAY_WINDOW;
+	attr->map = mmap(NULL, attr->map_len, PROT_READ, MAP_PRIVATE,
+			 attr->fd, offset);
+	if (attr->map == MAP_FAILED)
+	{
+		perror("Mapping schedule file");
+		exit(EXIT_FILEFAIL);
+	}
+	madvise(attr->map, attr->map_len, MADV_SEQUENTIAL);
+	attr->records = (const struct schedule_record *)
+		((const char *) attr->map + (pos - offset));
+	attr->first = index;
+	attr->len = (attr->map_len - (pos - offset))
+		/ sizeof(struct schedule_record);
+}
+
+
+
+int replay_generator_init(generator_t *this)
+{
+	struct replay_generator_attr *attr =
+		(struct replay_generator_attr *) this->attr;
+
+	/* size the ring for the mean interval at the start of the
+	 * schedule */
+	map_window(attr, 0);
+	const uint64_t n = attr->len < REPLAY_SAMPLE ? attr->len : REPLAY_SAMPLE;
+	uint64_t duration = 0;
+	uint64_t packets = 0;
+	for (uint64_t i = 0; i < n; i++)
+	{
+		duration += attr->records[i].delay;
+		if (attr->records[i].size > 0)
+			packets++;
+	}
+	this->block = create_sized_block_circle(this, packets > 0 ?
+						(double) duration / packets : 0);
+	attr->block_len = this->block->length;
+
+	struct packet_block *block = this->block;
+	do
+	{
+		replay_generator_fill_block(this, block);
+		block = block->next;
+	} while (block != this->block);
+
+	return 0;
+}
+
+
+
+/* Copy the next records into the block. When the schedule is over,
+ * the block is shortened, an empty block tells the sender to
+ * stop. */
+int replay_generator_fill_block(generator_t *this,
+				struct packet_block *current)
+{
+	struct replay_generator_attr *attr =
+		(struct replay_generator_attr *) this->attr;
+
+	int i = 0;
+	/* block index at the last restart of the schedule, to detect
+	 * schedules without packets */
+	int restart = -1;
+	while (i < attr->block_len)
+	{
+		if (attr->next == attr->hdr.count)
+		{
+			if (attr->loops == 1 || restart == i)
+				break;
+			restart = i;
+			if (attr->loops > 1)
+				attr->loops--;
+			attr->next = 0;
+		}
+		if (attr->map == NULL || attr->next < attr->first
+		    || attr->next >= attr->first + attr->len)
+			map_window(attr, attr->next);
+
+		const struct schedule_record *const rec =
+			&(attr->records[attr->next - attr->first]);
+		attr->next++;
+		attr->pending += rec->delay;
+		if (rec->size == 0)
+			continue;
+
+		ns_to_timespec(attr->pending, &(current->data[i].delay));
+		attr->pending = 0;
+		if (rec->size < MIN_PACKET_SIZE)
+			current->data[i].size = MIN_PACKET_SIZE;
+		else if (rec->size > (uint32_t) this->max_size)
+			current->data[i].size = this->max_size;
+		else
+			current->data[i].size = rec->size;
+		i++;
+	}
+	current->length = i;
+
+	return 0;
+}
+
+
+
+int replay_generator_destroy(generator_t *this)
+{
+	struct replay_generator_attr *attr =
+		(struct replay_generator_attr *) this->attr;
+	int ret = 0;
+
+	ret = destroy_block_circle(this->block); // pass error, if any
+	this->block = NULL;
+	if (attr->map != NULL)
+		munmap(attr->map, attr->map_len);
+	close(attr->fd);
+	free(this->attr);
+	return ret;
+}
@@ -0,0 +1,30 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_REPLAY_GENERATOR_H__
+#define __LUNA_REPLAY_GENERATOR_H__
+
+#include "generator.h"
+
+
+
+/* Prepare a generator that replays a schedule file (see
+ * schedule.h). */
+int replay_generator_create(generator_t *this, generator_option *args);
+
+#endif /* __LUNA_REPLAY_GENERATOR_H__ */
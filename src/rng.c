@@ -0,0 +1,120 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "rng.h"
+
+
+
+/* SplitMix64, used to expand the seed into the generator states as
+ * recommended by the authors of xoshiro */
+static uint64_t splitmix64(uint64_t *const x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+
+
+void rng_seed(struct rng *rng, const uint64_t seed, const uint64_t stream)
+{
+	uint64_t s = stream;
+	uint64_t x = seed ^ splitmix64(&s);
+	for (int l = 0; l < RNG_LANES; l++)
+		for (int i = 0; i < 4; i++)
+			rng->s[i][l] = splitmix64(&x);
+}
+
+
+
+/* Advance all lanes by one xoshiro256+ step and store the results
+ * in r as doubles in (0, 1). The upper 52 bits are used, the lowest
+ * bits of xoshiro256+ are weak. */
+static inline void step(struct rng *const rng, double r[RNG_LANES])
+{
+	uint64_t *const s0 = rng->s[0];
+	uint64_t *const s1 = rng->s[1];
+	uint64_t *const s2 = rng->s[2];
+	uint64_t *const s3 = rng->s[3];
+	for (int l = 0; l < RNG_LANES; l++)
+	{
+		const uint64_t result = s0[l] + s3[l];
+		const uint64_t t = s1[l] << 17;
+		s2[l] ^= s0[l];
+		s3[l] ^= s1[l];
+		s1[l] ^= s2[l];
+		s0[l] ^= s3[l];
+		s2[l] ^= t;
+		s3[l] = (s3[l] << 45) | (s3[l] >> 19);
+		r[l] = ((double) (result >> 12) + 0.5) * 0x1.0p-52;
+	}
+}
+
+
+
+void rng_uniform(struct rng *rng, double *out, const int n)
+{
+	int i = 0;
+	for (; i + RNG_LANES <= n; i += RNG_LANES)
+		step(rng, out + i);
+	if (i < n)
+	{
+		double r[RNG_LANES];
+		step(rng, r);
+		memcpy(out + i, r, (n - i) * sizeof(double));
+	}
+}
+
+
+
+/* Box-Muller transform, which unlike the ziggurat or polar methods
+ * needs no rejection and thus works on whole batches */
+void rng_gaussian(struct rng *rng, double *out, const int n)
+{
+	const int pairs = n / 2;
+	rng_uniform(rng, out, 2 * pairs);
+	for (int i = 0; i < 2 * pairs; i += 2)
+	{
+		const double r = sqrt(-2.0 * log(out[i]));
+		const double theta = 2.0 * M_PI * out[i + 1];
+		out[i] = r * cos(theta);
+		out[i + 1] = r * sin(theta);
+	}
+	if (n % 2)
+	{
+		double u[2];
+		rng_uniform(rng, u, 2);
+		out[n - 1] = sqrt(-2.0 * log(u[0])) * cos(2.0 * M_PI * u[1]);
+	}
+}
+
+
+
+/* Inversion method */
+void rng_exponential(struct rng *rng, double *out, const int n)
+{
+	rng_uniform(rng, out, n);
+	for (int i = 0; i < n; i++)
+		out[i] = -log(out[i]);
+}
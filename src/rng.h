@@ -0,0 +1,57 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_RNG_H__
+#define __LUNA_RNG_H__
+
+#include <stdint.h>
+
+/* Number of independent generator states advanced together. Each
+ * step produces one value per lane, the lanes are laid out so the
+ * compiler can keep them in one vector register. */
+#define RNG_LANES 4
+/* Seed used if a generator has none configured */
+#define RNG_DEFAULT_SEED 0
+
+/*
+ * Random number generator for the packet generators, RNG_LANES
+ * interleaved xoshiro256+ states. Values are produced in batches,
+ * usually one block of packets at a time, and a state must only be
+ * used by one thread.
+ */
+struct rng
+{
+	uint64_t s[4][RNG_LANES];
+};
+
+/* Initialize the states of all lanes from seed. Different streams
+ * (e.g. sender IDs) get independent states from the same seed. */
+void rng_seed(struct rng *rng, const uint64_t seed, const uint64_t stream);
+
+/* Fill out with n values uniformly distributed in (0, 1). Zero is
+ * excluded, so the values can be passed to log() safely. */
+void rng_uniform(struct rng *rng, double *out, const int n);
+
+/* Fill out with n values from the standard normal distribution */
+void rng_gaussian(struct rng *rng, double *out, const int n);
+
+/* Fill out with n values from the exponential distribution with
+ * mean 1 */
+void rng_exponential(struct rng *rng, double *out, const int n);
+
+#endif /* __LUNA_RNG_H__ */
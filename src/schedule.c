@@ -0,0 +1,72 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "schedule.h"
+
+
+
+void schedule_init_header(struct schedule_header *const hdr)
+{
+	memset(hdr, 0, sizeof(struct schedule_header));
+	memcpy(hdr->magic, SCHEDULE_MAGIC, sizeof(SCHEDULE_MAGIC));
+	hdr->version = SCHEDULE_VERSION;
+	hdr->record_size = sizeof(struct schedule_record);
+	hdr->loops = 1;
+}
+
+
+
+int schedule_check_header(const struct schedule_header *const hdr,
+			  const uint64_t file_size)
+{
+	if (memcmp(hdr->magic, SCHEDULE_MAGIC, sizeof(SCHEDULE_MAGIC)) != 0)
+	{
+		fprintf(stderr, "Input is not a LUNA replay schedule.\n");
+		return -1;
+	}
+	if (hdr->version != SCHEDULE_VERSION)
+	{
+		fprintf(stderr, "Unsupported schedule version %u (schedule "
+			"written on a host with different byte order?)\n",
+			hdr->version);
+		return -1;
+	}
+	if (hdr->record_size != sizeof(struct schedule_record))
+	{
+		fprintf(stderr, "Unexpected record size %u in schedule.\n",
+			hdr->record_size);
+		return -1;
+	}
+	/* compare record counts, the size of a corrupt count could
+	 * overflow */
+	if (file_size < sizeof(struct schedule_header)
+	    || hdr->count > (file_size - sizeof(struct schedule_header))
+	    / sizeof(struct schedule_record))
+	{
+		fprintf(stderr, "Schedule is truncated, expected %" PRIu64
+			" records.\n", hdr->count);
+		return -1;
+	}
+	return 0;
+}
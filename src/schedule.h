@@ -0,0 +1,72 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_SCHEDULE_H__
+#define __LUNA_SCHEDULE_H__
+
+#include <stdint.h>
+
+/*
+ * Replay schedule format, used by the replay generator and written
+ * by luna-schedule: A struct schedule_header followed by count
+ * struct schedule_record. All values are in host byte order, the
+ * version field doubles as byte order check (like binary logs, see
+ * binlog.h). The header is 32 bytes, a record 8 bytes, both without
+ * padding.
+ */
+
+#define SCHEDULE_MAGIC "LUNASCH"
+#define SCHEDULE_VERSION 1
+
+struct schedule_header
+{
+	char magic[8];
+	uint16_t version;
+	uint16_t record_size;
+	/* largest packet size in the schedule */
+	uint16_t max_size;
+	uint16_t reserved;
+	/* number of records */
+	uint64_t count;
+	/* how often the schedule is played, 0 for endless */
+	uint32_t loops;
+	uint32_t reserved2;
+};
+
+/* One packet: its delay relative to the previous record and its
+ * size. Records with size 0 only carry a delay, they are used for
+ * gaps longer than SCHEDULE_MAX_DELAY. */
+struct schedule_record
+{
+	uint32_t delay;
+	uint32_t size;
+};
+
+/* maximum delay of a single record (ns) */
+#define SCHEDULE_MAX_DELAY UINT32_MAX
+
+/* Fill in a header for a new schedule */
+void schedule_init_header(struct schedule_header *const hdr);
+
+/* Check a schedule header read from a file of the given size.
+ * Returns 0 if the header is valid, -1 otherwise (a message
+ * explaining the problem is written to stderr). */
+int schedule_check_header(const struct schedule_header *const hdr,
+			  const uint64_t file_size);
+
+#endif /* __LUNA_SCHEDULE_H__ */
@@ -0,0 +1,844 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/net_tstamp.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "luna.h"
+#include "protocol.h"
+#include "sender.h"
+
+/*
+ * Request slots for closed-loop mode. A slot is either idle, waiting
+ * until its think time is over, or has a request outstanding. Idle
+ * slots are kept in a binary min-heap ordered by the time their next
+ * request is due. All arrays are allocated before sending starts.
+ */
+struct request_slots
+{
+	/* number of slots */
+	int count;
+	/* sequence number of the outstanding request of each slot,
+	 * -1 if the slot is idle */
+	int64_t *seq;
+	/* idle slot: time its next request is due, outstanding
+	 * request: time it times out (ns on the timing clock) */
+	int64_t *due;
+	/* size of the next request of each idle slot */
+	size_t *size;
+	/* heap of idle slots, and its current length */
+	int *heap;
+	int idle;
+	/* slot that sent a request, indexed by sequence number &
+	 * seq_mask */
+	int *by_seq;
+	unsigned long seq_mask;
+};
+
+static int send_loop_sleep(struct send_state *const state, char *const buf);
+static int send_loop_txtime(struct send_state *const state,
+			    const int batch, const long lead_time);
+static int send_loop_closed(struct send_state *const state, char *const buf,
+			    struct request_slots *const slots);
+
+
+
+/* Sleep until the absolute time wakeup on clk_id. Sleeps interrupted
+ * by a signal are restarted. */
+static void sleep_until(const clockid_t clk_id,
+			const struct timespec *const wakeup)
+{
+	int ret;
+	do
+		ret = clock_nanosleep(clk_id, TIMER_ABSTIME, wakeup, NULL);
+	while (ret == EINTR);
+	if (ret != 0)
+		fprintf(stderr, "Error while sleeping: %s\n", strerror(ret));
+}
+
+
+
+/* Wait until state->nexttick. Without spin margin, this is just an
+ * absolute clock_nanosleep(). Otherwise sleep until spin_margin
+ * before the deadline and busy-wait for the rest, counting cases in
+ * which the wakeup came too late. */
+static inline void wait_for_tick(struct send_state *const state)
+{
+	if (state->spin_margin == 0)
+	{
+		sleep_until(state->clk_id, &(state->nexttick));
+		return;
+	}
+
+	const int64_t tick = timespec_to_ns(&(state->nexttick));
+	const int64_t wake = tick - state->spin_margin;
+	struct timespec now;
+	clock_gettime(state->clk_id, &now);
+	if (timespec_to_ns(&now) < wake)
+	{
+		struct timespec wakeup;
+		ns_to_timespec(wake, &wakeup);
+		sleep_until(state->clk_id, &wakeup);
+		clock_gettime(state->clk_id, &now);
+		if (timespec_to_ns(&now) > tick)
+		{
+			state->spin_misses++;
+			return;
+		}
+	}
+	while (timespec_to_ns(&now) < tick)
+		clock_gettime(state->clk_id, &now);
+}
+
+
+
+/* Number of sleeps used to calibrate the spin margin, and the time
+ * to sleep for each one (ns) */
+#define SPIN_CALIBRATION_ROUNDS 200
+#define SPIN_CALIBRATION_SLEEP (200 * NS_PER_US)
+
+static int compare_int64(const void *a, const void *b)
+{
+	const int64_t x = *((const int64_t *) a);
+	const int64_t y = *((const int64_t *) b);
+	return (x > y) - (x < y);
+}
+
+
+
+/* Measure how late clock_nanosleep() wakes up on this system. The
+ * returned spin margin (ns) is the 99th percentile of the measured
+ * overshoots. Must be called from the sending thread after it got
+ * its final scheduling parameters. */
+static int64_t calibrate_spin_margin(const clockid_t clk_id)
+{
+	int64_t *const overshoot =
+		calloc(SPIN_CALIBRATION_ROUNDS, sizeof(int64_t));
+	CHKALLOC(overshoot);
+	struct timespec target;
+	struct timespec now;
+	for (int i = 0; i < SPIN_CALIBRATION_ROUNDS; i++)
+	{
+		clock_gettime(clk_id, &target);
+		const int64_t t =
+			timespec_to_ns(&target) + SPIN_CALIBRATION_SLEEP;
+		ns_to_timespec(t, &target);
+		clock_nanosleep(clk_id, TIMER_ABSTIME, &target, NULL);
+		clock_gettime(clk_id, &now);
+		overshoot[i] = timespec_to_ns(&now) - t;
+	}
+	qsort(overshoot, SPIN_CALIBRATION_ROUNDS, sizeof(int64_t),
+	      &compare_int64);
+	int64_t margin = overshoot[SPIN_CALIBRATION_ROUNDS * 99 / 100];
+	free(overshoot);
+	/* a margin of 0 would disable spinning */
+	return margin > 0 ? margin : 1;
+}
+
+
+
+/* time to sleep between checks while the sender is stalled because
+ * of a buffer underrun (ns) */
+#define STALL_POLL (10 * NS_PER_US)
+
+/* Move on to the next block of the ring. If it is not ready yet,
+ * handle the underrun according to state->underrun_policy. Returns
+ * -1 if sending should stop, 0 otherwise. */
+static int next_block(struct send_state *const state)
+{
+	struct block_ring *const ring = state->generator->ring;
+	if (!ring->dynamic || block_ring_advance(ring))
+	{
+		state->block = state->block->next;
+		return 0;
+	}
+
+	state->underruns++;
+	switch (state->underrun_policy)
+	{
+	case UNDERRUN_REPEAT:
+		/* keep the current block */
+		return 0;
+	case UNDERRUN_ABORT:
+		fprintf(stderr, "ERROR: The next send parameter block is "
+			"not ready! Make sure your data generator is fast "
+			"enough.\n");
+		return -1;
+	default:
+	{
+		struct timespec start, now;
+		const struct timespec wait = {0, STALL_POLL};
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		while (!block_ring_advance(ring))
+			clock_nanosleep(CLOCK_MONOTONIC, 0, &wait, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		state->stall_time +=
+			timespec_to_ns(&now) - timespec_to_ns(&start);
+		state->block = state->block->next;
+		return 0;
+	}
+	}
+}
+
+
+
+/* Get the parameters for the next packet. Switches to the next
+ * block of the ring when the current one is used up. Returns NULL if
+ * sending should stop. */
+static const struct packet_data *next_data(struct send_state *const state)
+{
+	if (state->bi == state->block->length)
+	{
+		state->bi = 0;
+		if (next_block(state) != 0)
+			return NULL;
+		/* an empty block marks the end of the schedule */
+		if (state->block->length == 0)
+			return NULL;
+	}
+	return &(state->block->data[state->bi++]);
+}
+
+
+
+/* Get the parameters for the next packet and add its delay to
+ * state->nexttick. Returns NULL if sending should stop. */
+static const struct packet_data *next_packet(struct send_state *const state)
+{
+	const struct packet_data *const data = next_data(state);
+	if (data != NULL)
+		timespecadd(&(state->nexttick), &(data->delay),
+			    &(state->nexttick));
+	return data;
+}
+
+
+
+/* Write the LUNA header for a packet into buf */
+static inline void write_header(char *const buf,
+				const struct send_state *const state,
+				const int64_t seq, const int64_t sendtime)
+{
+	const struct packet_header hdr = {
+		.sequence = seq,
+		.send_time = sendtime,
+		.flow = state->flow,
+		.flags = state->flags,
+		.version = state->version,
+		.length = state->version >= PROTOCOL_V2 ?
+		PROTOCOL_V2_HEADER_SIZE : PROTOCOL_V1_HEADER_SIZE
+	};
+	packet_write_header(buf, &hdr);
+}
+
+
+
+struct echo_queue *echo_queue_create(const int size)
+{
+	struct echo_queue *const queue = calloc(1, sizeof(struct echo_queue));
+	CHKALLOC(queue);
+	unsigned long len = 1;
+	while (len < (unsigned long) size)
+		len <<= 1;
+	queue->mask = len - 1;
+	queue->seq = calloc(len, sizeof(int64_t));
+	CHKALLOC(queue->seq);
+	touch_page(queue->seq, len * sizeof(int64_t));
+	atomic_init(&(queue->head), 0);
+	atomic_init(&(queue->tail), 0);
+	if (sem_init(&(queue->posted), 0, 0) != 0)
+	{
+		perror("Initializing echo queue semaphore");
+		exit(EXIT_MEMFAIL);
+	}
+	return queue;
+}
+
+
+
+void echo_queue_destroy(struct echo_queue *queue)
+{
+	sem_destroy(&(queue->posted));
+	free(queue->seq);
+	free(queue);
+}
+
+
+
+/* Minimum size of the sequence number to slot map in closed-loop
+ * mode, and the minimum ratio of its size to the number of slots */
+#define SLOT_MAP_MIN 256
+#define SLOT_MAP_FACTOR 4
+
+static void request_slots_init(struct request_slots *const slots,
+			       const int count)
+{
+	slots->count = count;
+	slots->idle = 0;
+	slots->seq = calloc(count, sizeof(int64_t));
+	CHKALLOC(slots->seq);
+	slots->due = calloc(count, sizeof(int64_t));
+	CHKALLOC(slots->due);
+	slots->size = calloc(count, sizeof(size_t));
+	CHKALLOC(slots->size);
+	slots->heap = calloc(count, sizeof(int));
+	CHKALLOC(slots->heap);
+	unsigned long len = SLOT_MAP_MIN;
+	while (len < (unsigned long) count * SLOT_MAP_FACTOR)
+		len <<= 1;
+	slots->seq_mask = len - 1;
+	slots->by_seq = calloc(len, sizeof(int));
+	CHKALLOC(slots->by_seq);
+	touch_page(slots->by_seq, len * sizeof(int));
+	for (int i = 0; i < count; i++)
+		slots->seq[i] = -1;
+}
+
+
+
+static void request_slots_destroy(struct request_slots *const slots)
+{
+	free(slots->by_seq);
+	free(slots->heap);
+	free(slots->size);
+	free(slots->due);
+	free(slots->seq);
+}
+
+
+
+void *sender_thread(void *arg)
+{
+	struct sender *const sender = (struct sender *) arg;
+	const struct client_config *const config = sender->config;
+	struct send_state *const state = &(sender->state);
+
+	if (sender->cpu >= 0)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(sender->cpu, &cpus);
+		const int ret = pthread_setaffinity_np(pthread_self(),
+						       sizeof(cpu_set_t),
+						       &cpus);
+		if (ret != 0)
+			fprintf(stderr, "Could not pin sender %i to CPU %i: "
+				"%s\n", sender->id, sender->cpu,
+				strerror(ret));
+	}
+
+	state->generator = &(sender->generator);
+	state->clk_id = config->clk_id;
+	if (config->echo)
+		state->flags = state->flags | LUNA_FLAG_ECHO;
+	if (config->server_stamps)
+		state->flags = state->flags | LUNA_FLAG_STAMPS;
+	if (config->send_mode == SEND_MODE_SPIN)
+	{
+		if (config->spin_margin > 0)
+			state->spin_margin = config->spin_margin;
+		else
+			state->spin_margin =
+				calibrate_spin_margin(config->clk_id);
+		fprintf(stderr, "Sender %i: spin margin %" PRId64 "ns\n",
+			sender->id, state->spin_margin);
+	}
+
+	/* Allocate buffer, based on upper size limit provided by the
+	 * generator. The txtime mode needs one buffer per packet in a
+	 * batch and allocates them itself. */
+	char *buf = NULL;
+	if (config->send_mode != SEND_MODE_TXTIME)
+	{
+		buf = malloc(sender->generator.max_size);
+		CHKALLOC(buf);
+		memset(buf, 7, sender->generator.max_size);
+	}
+
+	state->block = sender->generator.block;
+	state->bi = 0;
+	state->underrun_policy = config->underrun;
+
+	struct request_slots slots;
+	if (config->closed_loop > 0)
+	{
+		state->slots = config->closed_loop;
+		state->request_timeout = config->request_timeout;
+		request_slots_init(&slots, state->slots);
+	}
+
+	/* When the schedule is split across several senders, each one
+	 * starts a fraction of its first interval later than the
+	 * previous one, so their packets interleave. The first delay
+	 * is already multiplied by the number of senders. */
+	const int64_t phase = timespec_to_ns(&(state->block->data[0].delay))
+		* sender->id / config->threads;
+
+	/* wait for the other senders, then for the start time */
+	pthread_barrier_wait(sender->barrier);
+	pthread_barrier_wait(sender->barrier);
+
+	ns_to_timespec(timespec_to_ns(sender->start) + phase,
+		       &(state->nexttick));
+	state->end.tv_sec = sender->start->tv_sec + config->time;
+	state->end.tv_nsec = sender->start->tv_nsec;
+
+	/* Store page fault statistics to check if memory management
+	 * is working properly */
+	struct rusage usage_pre;
+	struct rusage usage_post;
+	getrusage(RUSAGE_THREAD, &usage_pre);
+
+	if (config->closed_loop > 0)
+		send_loop_closed(state, buf, &slots);
+	else if (config->send_mode == SEND_MODE_TXTIME)
+		send_loop_txtime(state, config->batch, config->lead_time);
+	else
+		send_loop_sleep(state, buf);
+
+	/* Check page fault statistics to see if memory management is
+	 * working properly */
+	getrusage(RUSAGE_THREAD, &usage_post);
+	if (check_pfaults(&usage_pre, &usage_post))
+		fprintf(stderr,
+			"WARNING: Page faults occurred in real-time section "
+			"of sender %i!\n"
+			"Pre:  Major-pagefaults: %ld, Minor Pagefaults: %ld\n"
+			"Post: Major-pagefaults: %ld, Minor Pagefaults: %ld\n",
+			sender->id,
+			usage_pre.ru_majflt, usage_pre.ru_minflt,
+			usage_post.ru_majflt, usage_post.ru_minflt);
+
+	/* send buffer isn't needed any more */
+	free(buf);
+	if (config->closed_loop > 0)
+		request_slots_destroy(&slots);
+	return NULL;
+}
+
+
+
+/* Send one packet at a time: wait until it is due, record the
+ * current time into the packet and send it. Used for both sleep and
+ * spin mode, see wait_for_tick(). */
+static int send_loop_sleep(struct send_state *const state, char *const buf)
+{
+	write_header(buf, state, 0, 0);
+
+	struct timespec now = {0, 0};
+	/* time right before sending */
+	struct timespec sendtime;
+
+	while (now.tv_sec < state->end.tv_sec
+	       || now.tv_nsec < state->end.tv_nsec)
+	{
+		const struct packet_data *const data = next_packet(state);
+		if (data == NULL)
+			return -1;
+
+		packet_set_sequence(buf, state->version, state->seq++);
+		/* wait until scheduled send time */
+		wait_for_tick(state);
+		/* record current time into the packet */
+		clock_gettime(CLOCK_REALTIME, &sendtime);
+		packet_set_time(buf, state->version,
+				timespec_to_ns(&sendtime));
+		/* send the packet */
+		if (send(state->sock, buf, data->size, 0) == -1)
+		{
+			perror("Error while sending");
+			state->send_errors++;
+		}
+
+		/* get the current time, needed to stop the loop at
+		 * the right time */
+		clock_gettime(state->clk_id, &now);
+	}
+
+	return 0;
+}
+
+
+
+/*
+ * Send packets in batches using sendmmsg(). Each packet carries its
+ * scheduled send time in an SCM_TXTIME control message, so the qdisc
+ * (fq or etf) is responsible for sending it on time. A batch is
+ * handed to the kernel lead_time before its first packet is due, and
+ * contains at most batch packets, all of which are due less than
+ * lead_time after the first one. The send time recorded in the
+ * packets is the scheduled one.
+ *
+ * The fq qdisc uses CLOCK_MONOTONIC, while etf requires CLOCK_TAI.
+ * If timing is based on CLOCK_REALTIME (e.g. because of a fixed
+ * start time), CLOCK_TAI is used for the kernel timestamps, so etf
+ * must be used. Otherwise the kernel gets CLOCK_MONOTONIC
+ * timestamps, suitable for fq.
+ */
+static int send_loop_txtime(struct send_state *const state,
+			    const int batch, const long lead_time)
+{
+	const int max_size = state->generator->max_size;
+	const clockid_t txclock =
+		state->clk_id == CLOCK_REALTIME ? CLOCK_TAI : CLOCK_MONOTONIC;
+	const struct sock_txtime txconf = {
+		.clockid = txclock,
+		.flags = 0
+	};
+	if (setsockopt(state->sock, SOL_SOCKET, SO_TXTIME,
+		       &txconf, sizeof(txconf)) != 0)
+	{
+		perror("setsockopt SO_TXTIME");
+		exit(EXIT_NETFAIL);
+	}
+
+	/* one buffer, iovec, header and control message per packet
+	 * in a batch */
+	char *const bufs = malloc(batch * max_size);
+	CHKALLOC(bufs);
+	memset(bufs, 7, batch * max_size);
+	struct iovec *const iov = calloc(batch, sizeof(struct iovec));
+	CHKALLOC(iov);
+	struct mmsghdr *const msgs = calloc(batch, sizeof(struct mmsghdr));
+	CHKALLOC(msgs);
+	const size_t cmsg_space = CMSG_SPACE(sizeof(uint64_t));
+	char *const cbufs = calloc(batch, cmsg_space);
+	CHKALLOC(cbufs);
+	for (int i = 0; i < batch; i++)
+	{
+		iov[i].iov_base = bufs + i * max_size;
+		msgs[i].msg_hdr.msg_iov = &(iov[i]);
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = cbufs + i * cmsg_space;
+		msgs[i].msg_hdr.msg_controllen = cmsg_space;
+		struct cmsghdr *const cm = CMSG_FIRSTHDR(&(msgs[i].msg_hdr));
+		cm->cmsg_level = SOL_SOCKET;
+		cm->cmsg_type = SCM_TXTIME;
+		cm->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+	}
+
+	/* Offsets from the timing clock to the clock used for kernel
+	 * timestamps and to CLOCK_REALTIME (for the send time in the
+	 * packets). Measured once, drift during a run is ignored. */
+	struct timespec ts_clk, ts_tx, ts_real;
+	clock_gettime(state->clk_id, &ts_clk);
+	clock_gettime(txclock, &ts_tx);
+	clock_gettime(CLOCK_REALTIME, &ts_real);
+	const int64_t tx_offset =
+		timespec_to_ns(&ts_tx) - timespec_to_ns(&ts_clk);
+	const int64_t real_offset =
+		timespec_to_ns(&ts_real) - timespec_to_ns(&ts_clk);
+
+	const int64_t end = timespec_to_ns(&(state->end));
+	struct timespec wakeup = {0, 0};
+	/* number of packets in the current batch, and whether the
+	 * last one fetched belongs to the next batch already */
+	int n = 0;
+	int carry = 0;
+	int done = 0;
+
+	while (!done)
+	{
+		int64_t first = 0;
+		/* a packet left over from the previous batch moves
+		 * to the start of this one */
+		if (carry)
+		{
+			memcpy(bufs, bufs + n * max_size, MIN_PACKET_SIZE);
+			iov[0].iov_len = iov[n].iov_len;
+			*((uint64_t *) CMSG_DATA(CMSG_FIRSTHDR(&(msgs[0].msg_hdr))))
+				= *((uint64_t *) CMSG_DATA(CMSG_FIRSTHDR(&(msgs[n].msg_hdr))));
+			first = *((uint64_t *) CMSG_DATA(CMSG_FIRSTHDR(&(msgs[0].msg_hdr))))
+				- tx_offset;
+			n = 1;
+			carry = 0;
+		}
+		else
+			n = 0;
+
+		while (n < batch)
+		{
+			const struct packet_data *const data =
+				next_packet(state);
+			if (data == NULL)
+			{
+				done = 1;
+				break;
+			}
+			const int64_t tick = timespec_to_ns(&(state->nexttick));
+			if (tick >= end)
+			{
+				done = 1;
+				break;
+			}
+
+			write_header(iov[n].iov_base, state, state->seq++,
+				     tick + real_offset);
+			iov[n].iov_len = data->size;
+			*((uint64_t *) CMSG_DATA(CMSG_FIRSTHDR(&(msgs[n].msg_hdr))))
+				= tick + tx_offset;
+
+			if (n == 0)
+				first = tick;
+			else if (tick - first >= lead_time)
+			{
+				/* too far ahead, send it with the
+				 * next batch */
+				carry = 1;
+				break;
+			}
+			n++;
+		}
+		if (n == 0)
+			break;
+
+		/* sleep until the batch has to be handed over */
+		const int64_t wake = first - lead_time;
+		ns_to_timespec(wake, &wakeup);
+		sleep_until(state->clk_id, &wakeup);
+
+		for (int sent = 0; sent < n;)
+		{
+			const int r = sendmmsg(state->sock, msgs + sent,
+					       n - sent, 0);
+			if (r == -1)
+			{
+				/* the first message of the rest failed,
+				 * skip only that one */
+				perror("Error while sending");
+				state->send_errors++;
+				sent++;
+			}
+			else
+				sent += r;
+		}
+	}
+
+	free(cbufs);
+	free(msgs);
+	free(iov);
+	free(bufs);
+	return 0;
+}
+
+
+
+/* Add an idle slot to the heap of closed-loop request slots */
+static void slot_heap_push(struct request_slots *const slots, const int slot)
+{
+	int i = slots->idle++;
+	while (i > 0)
+	{
+		const int parent = (i - 1) / 2;
+		if (slots->due[slots->heap[parent]] <= slots->due[slot])
+			break;
+		slots->heap[i] = slots->heap[parent];
+		i = parent;
+	}
+	slots->heap[i] = slot;
+}
+
+
+
+/* Remove the idle slot whose request is due first from the heap and
+ * return it */
+static int slot_heap_pop(struct request_slots *const slots)
+{
+	const int top = slots->heap[0];
+	const int last = slots->heap[--(slots->idle)];
+	int i = 0;
+	for (int child = 1; child < slots->idle; child = 2 * i + 1)
+	{
+		if (child + 1 < slots->idle
+		    && slots->due[slots->heap[child + 1]]
+		    < slots->due[slots->heap[child]])
+			child++;
+		if (slots->due[last] <= slots->due[slots->heap[child]])
+			break;
+		slots->heap[i] = slots->heap[child];
+		i = child;
+	}
+	slots->heap[i] = last;
+	return top;
+}
+
+
+
+/* Mark the request of slot as finished and schedule the next one
+ * after its think time, starting at now. Returns -1 if sending should
+ * stop. */
+static int slot_schedule(struct send_state *const state,
+			 struct request_slots *const slots,
+			 const int slot, const int64_t now)
+{
+	const struct packet_data *const data = next_data(state);
+	if (data == NULL)
+		return -1;
+	slots->seq[slot] = -1;
+	slots->due[slot] = now + timespec_to_ns(&(data->delay));
+	slots->size[slot] = data->size;
+	slot_heap_push(slots, slot);
+	return 0;
+}
+
+
+
+/*
+ * Closed-loop mode: Each of state->slots request slots sends a
+ * packet, waits until its echo arrives (reported by the echo thread
+ * through state->queue) or state->request_timeout has passed, waits
+ * for the think time (the delay from the generator), and then sends
+ * the next request, with the size provided by the generator.
+ *
+ * Requests are sent in sequence number order, and all of them time
+ * out after the same time, so the oldest outstanding request is
+ * always the next one to time out. It is found by walking the
+ * sequence numbers from the oldest one not known to be finished.
+ */
+static int send_loop_closed(struct send_state *const state, char *const buf,
+			    struct request_slots *const slots)
+{
+	struct echo_queue *const queue = state->queue;
+	write_header(buf, state, 0, 0);
+
+	const int64_t end = timespec_to_ns(&(state->end));
+	struct timespec now_ts = state->nexttick;
+	int64_t now = timespec_to_ns(&now_ts);
+	for (int i = 0; i < slots->count; i++)
+		if (slot_schedule(state, slots, i, now) != 0)
+			return -1;
+	/* oldest request that may still be outstanding */
+	int64_t oldest = state->seq;
+	/* time right before sending */
+	struct timespec sendtime;
+	struct timespec wakeup;
+
+	while (now < end)
+	{
+		/* finish requests whose echoes have arrived */
+		int64_t seq;
+		while (echo_queue_pop(queue, &seq))
+		{
+			if (seq < oldest || seq >= state->seq)
+				continue;
+			const int slot = slots->by_seq[seq & slots->seq_mask];
+			/* duplicate, or echo of a timed out request */
+			if (slots->seq[slot] != seq)
+				continue;
+			state->completed++;
+			if (slot_schedule(state, slots, slot, now) != 0)
+				return -1;
+		}
+
+		/* give up on requests that timed out */
+		int64_t timeout = end;
+		while (oldest < state->seq)
+		{
+			const int slot =
+				slots->by_seq[oldest & slots->seq_mask];
+			if (slots->seq[slot] != oldest)
+			{
+				oldest++;
+				continue;
+			}
+			if (slots->due[slot] > now)
+			{
+				timeout = slots->due[slot];
+				break;
+			}
+			state->timeouts++;
+			if (slot_schedule(state, slots, slot, now) != 0)
+				return -1;
+			oldest++;
+		}
+
+		/* send the requests that are due */
+		while (slots->idle > 0 && slots->due[slots->heap[0]] <= now)
+		{
+			const int slot = slot_heap_pop(slots);
+			seq = state->seq++;
+			/* A request still outstanding after
+			 * seq_mask + 1 newer ones is given up, so the
+			 * slot map entry can be reused. */
+			const int prev = slots->by_seq[seq & slots->seq_mask];
+			if (seq > (int64_t) slots->seq_mask
+			    && slots->seq[prev]
+			    == seq - (int64_t) slots->seq_mask - 1)
+			{
+				state->timeouts++;
+				if (slot_schedule(state, slots, prev, now) != 0)
+					return -1;
+			}
+			slots->by_seq[seq & slots->seq_mask] = slot;
+			slots->seq[slot] = seq;
+			slots->due[slot] = now + state->request_timeout;
+			if (timeout > slots->due[slot])
+				timeout = slots->due[slot];
+
+			packet_set_sequence(buf, state->version, seq);
+			clock_gettime(CLOCK_REALTIME, &sendtime);
+			packet_set_time(buf, state->version,
+					timespec_to_ns(&sendtime));
+			if (send(state->sock, buf, slots->size[slot], 0) == -1)
+			{
+				perror("Error while sending");
+				state->send_errors++;
+			}
+		}
+
+		/* Sleep until the next request is due, the oldest
+		 * one times out, or an echo arrives. Posts for echoes
+		 * that have been handled already are discarded
+		 * first. If an echo is pushed after the queue has
+		 * been checked, its post wakes up the sender. */
+		int64_t wake = timeout;
+		if (slots->idle > 0 && slots->due[slots->heap[0]] < wake)
+			wake = slots->due[slots->heap[0]];
+		while (sem_trywait(&(queue->posted)) == 0)
+			; /* just drain the semaphore */
+		if (atomic_load_explicit(&(queue->head), memory_order_acquire)
+		    == atomic_load_explicit(&(queue->tail),
+					    memory_order_relaxed))
+		{
+			ns_to_timespec(wake, &wakeup);
+			/* timeouts and signals are normal wakeups, the
+			 * loop checks what is due */
+			if (sem_clockwait(&(queue->posted), state->clk_id,
+					  &wakeup) == -1
+			    && errno != ETIMEDOUT && errno != EINTR)
+				perror("Error while waiting for echoes");
+		}
+		clock_gettime(state->clk_id, &now_ts);
+		now = timespec_to_ns(&now_ts);
+	}
+
+	return 0;
+}
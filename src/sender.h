@@ -0,0 +1,181 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_SENDER_H__
+#define __LUNA_SENDER_H__
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "client.h"
+#include "generator.h"
+#include "traffic.h"
+
+/*
+ * Closed-loop mode: queue of the sequence numbers of received echoes
+ * from the echo thread (producer) of a sender to the sender
+ * (consumer). Like struct block_ring it works without locks, the
+ * semaphore is only used to wake up the sender.
+ *
+ * head: number of sequence numbers pushed
+ * tail: number of sequence numbers popped
+ */
+struct echo_queue
+{
+	_Alignas(CACHE_LINE_SIZE) atomic_ulong head;
+	_Alignas(CACHE_LINE_SIZE) atomic_ulong tail;
+	/* number of elements in seq minus one, the number of
+	 * elements is a power of two */
+	_Alignas(CACHE_LINE_SIZE) unsigned long mask;
+	int64_t *seq;
+	/* posted after each push */
+	sem_t posted;
+	/* number of echoes that did not fit into the queue (producer
+	 * only) */
+	long dropped;
+};
+
+/* State of the sending loop, shared by the send modes */
+struct send_state
+{
+	/* connected socket to send on */
+	int sock;
+	/* generator providing the send parameter blocks */
+	generator_t *generator;
+	/* current send parameter block, and the index of the next
+	 * packet in it */
+	struct packet_block *block;
+	int bi;
+	/* what to do if the next block is not ready, one of the
+	 * UNDERRUN_* constants from traffic.h */
+	int underrun_policy;
+	/* number of times the next block was not ready, and total
+	 * time spent waiting for blocks (ns, stall policy) */
+	long underruns;
+	int64_t stall_time;
+	/* next sequence number */
+	int64_t seq;
+	/* number of packets the socket refused to send */
+	long send_errors;
+	/* protocol version, flow ID and flags for outgoing packets */
+	int version;
+	uint32_t flow;
+	char flags;
+	/* clock used for timing, and the scheduled send time of the
+	 * most recent packet on this clock */
+	clockid_t clk_id;
+	struct timespec nexttick;
+	/* stop sending at this time */
+	struct timespec end;
+	/* spin mode: stop sleeping this long before a packet is due
+	 * (ns), 0 for sleep-only timing */
+	int64_t spin_margin;
+	/* spin mode: number of packets for which the thread woke up
+	 * after the scheduled send time */
+	long spin_misses;
+	/* closed-loop mode: number of request slots, queue of
+	 * received echoes, and how long to wait for an echo before
+	 * sending the next request of the slot (ns) */
+	int slots;
+	struct echo_queue *queue;
+	int64_t request_timeout;
+	/* closed-loop mode: number of requests answered, and of
+	 * requests given up after request_timeout */
+	long completed;
+	long timeouts;
+};
+
+
+/*
+ * One sending thread. Each sender has its own socket, generator and
+ * send parameter ring, and numbers its packets independently starting
+ * at 0, so the server can tell senders apart by their source port.
+ */
+struct sender
+{
+	/* index of this sender (0 to threads - 1) */
+	int id;
+	/* CPU to pin the sending thread to, or -1 for no pinning */
+	int cpu;
+	/* client settings shared by all senders */
+	const struct client_config *config;
+	/* the generator and its thread, and the semaphore it posts
+	 * to when it is ready */
+	generator_t generator;
+	pthread_t gen_thread;
+	sem_t ready;
+	/* the sending thread */
+	pthread_t thread;
+	/* state of the send loop */
+	struct send_state state;
+	/* All senders and run_client wait on this barrier twice:
+	 * once when the senders are ready, and once after run_client
+	 * has set *start. */
+	pthread_barrier_t *barrier;
+	/* common start time of all senders (on config->clk_id) */
+	const struct timespec *start;
+};
+
+/*
+ * Sending thread, the argument must be a struct sender *. The socket
+ * and the generator in the struct must be ready to use when the
+ * thread is started.
+ */
+void *sender_thread(void *arg);
+
+/* Allocate an echo queue with room for at least size sequence
+ * numbers. Free it using echo_queue_destroy(). */
+struct echo_queue *echo_queue_create(const int size);
+void echo_queue_destroy(struct echo_queue *queue);
+
+/* Producer side: Add a sequence number to the queue and wake up the
+ * consumer. If the queue is full, the sequence number is dropped. */
+static inline void echo_queue_push(struct echo_queue *const queue,
+				   const int64_t seq)
+{
+	const unsigned long head =
+		atomic_load_explicit(&(queue->head), memory_order_relaxed);
+	if (head - atomic_load_explicit(&(queue->tail), memory_order_acquire)
+	    > queue->mask)
+	{
+		queue->dropped++;
+		return;
+	}
+	queue->seq[head & queue->mask] = seq;
+	atomic_store_explicit(&(queue->head), head + 1, memory_order_release);
+	sem_post(&(queue->posted));
+}
+
+/* Consumer side: Take the oldest sequence number from the queue and
+ * store it in *seq. Returns zero if the queue was empty. */
+static inline int echo_queue_pop(struct echo_queue *const queue,
+				 int64_t *const seq)
+{
+	const unsigned long tail =
+		atomic_load_explicit(&(queue->tail), memory_order_relaxed);
+	if (tail == atomic_load_explicit(&(queue->head), memory_order_acquire))
+		return 0;
+	*seq = queue->seq[tail & queue->mask];
+	atomic_store_explicit(&(queue->tail), tail + 1, memory_order_release);
+	return 1;
+}
+
+#endif /* __LUNA_SENDER_H__ */
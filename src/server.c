@@ -19,247 +19,953 @@
 #include <config.h>
 
 #include <arpa/inet.h>
-#include <linux/sockios.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <linux/filter.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/time.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "binlog.h"
+#include "flowstats.h"
+#include "flowtable.h"
+#include "logwriter.h"
+#include "protocol.h"
 #include "luna.h"
 #include "server.h"
 
-/* length for address and port strings (probably a bit longer than
- * required) */
-#define ADDR_STR_LEN 100
+/* maximum number of packets to receive with one recvmmsg() call */
+#define SERVER_RECV_BATCH 64
+/* maximum number of flows (source address and port) that get their
+ * own ID per receiver, packets of any further flows are logged with
+ * BINLOG_FLOW_OTHER */
+#define SERVER_MAX_FLOWS FLOW_TABLE_MAX_FLOWS
+/* receive timeout for multi-threaded servers, the receive threads
+ * check if they should stop at this interval (µs) */
+#define SERVER_STOP_POLL 100000
+
+/* State for formatting log records as text in the writer thread */
+struct text_format
+{
+	int flags;
+	/* names indexed by flow ID, the last element is used for
+	 * BINLOG_FLOW_OTHER */
+	struct binlog_flow_names *names;
+	uint32_t max_flows;
+};
+
+/* One receive thread with its own socket and log */
+struct receiver
+{
+	/* index of this receiver (0 to threads - 1) */
+	int id;
+	/* CPU to pin the receive thread to, or -1 for no pinning */
+	int cpu;
+	int sock;
+	/* writer for the log of this receiver, NULL if no log is
+	 * written */
+	struct log_writer *writer;
+	pthread_t thread;
+	/* flows seen by this receiver, and their statistics indexed
+	 * by flow ID */
+	struct flow_table flows;
+	struct flow_stats *stats;
+	/* packets of flows that did not fit into the flow table */
+	int64_t untracked;
+	/* interval for statistics reports (s), 0 for none */
+	int stats_interval;
+	/* number of receivers of the server */
+	int threads;
+	/* multi-threaded only: binary log of this receiver, merged
+	 * into the output at shutdown. partpath is NULL for
+	 * temporary files. */
+	int partfd;
+	char *partpath;
+};
 
 /* changed to 0 by the termination handler to stop the receive loop
  * (if the SERVER_GRACEFUL_EXIT flag is set) */
 volatile sig_atomic_t work = 1;
 
-int run_server(struct addrinfo *const addr, const int flags,
-	       const char *const datafile)
-{
-	/* inet6_only one must be a real variable so it can be used in
-	 * setsockopt. */
-	const int inet6_only = flags & SERVER_IPV6_ONLY;
 
-	/* create the socket */
-	int sock;
-	const struct addrinfo *rp;
-	for (rp = addr; rp != NULL; rp = rp->ai_next)
+
+/* Get the ID of the flow the source address belongs to. If the flow
+ * is new, a flow record is pushed to the log writer. */
+static uint32_t flow_id(struct flow_table *const flows,
+			const struct sockaddr *const addr,
+			const socklen_t addrlen,
+			struct log_writer *const writer)
+{
+	struct binlog_record rec;
+	int created = 0;
+	uint32_t id = flow_table_lookup(flows, addr, addrlen, &created);
+	if (id == FLOW_ID_NONE)
+	{
+		/* the address has to be repeated for every packet */
+		id = BINLOG_FLOW_OTHER;
+		created = 1;
+	}
+	if (created && writer != NULL)
 	{
-		sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-		if (sock == -1)
-			continue; // didn't work, try next address
+		binlog_fill_flow(&rec, id, addr);
+		log_writer_push(writer, &rec);
+	}
+	return id;
+}
 
-		if (rp->ai_family == AF_INET6)
-			if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY,
-				       &inet6_only, sizeof(inet6_only)) != 0)
-			{
-				perror("setsockopt IPV6_V6ONLY");
-				exit(EXIT_NETFAIL);
-			}
 
-		if (bind(sock, rp->ai_addr, rp->ai_addrlen) == 0)
-			break; // connected (well, it's UDP, but...)
 
-		close(sock);
+/* Format a log record as text (log_format_t), called by the writer
+ * thread. TSV times are in microseconds to keep the columns
+ * compatible, with the nanoseconds as decimal places. */
+static size_t format_record(void *arg, const struct binlog_record *rec,
+			    char *buf)
+{
+	struct text_format *const fmt = (struct text_format *) arg;
+	struct binlog_flow_names *names =
+		&(fmt->names[rec->flow == BINLOG_FLOW_OTHER ?
+			     fmt->max_flows : rec->flow]);
+
+	if (rec->type == BINLOG_REC_FLOW)
+	{
+		binlog_flow_names(rec, names);
+		return 0;
 	}
-	if (rp == NULL)
+
+	const char *const addrstr = names->valid ? names->addr : "?";
+	const char *const portstr = names->valid ? names->port : "?";
+	struct timespec ptime;
+	ns_to_timespec(rec->data.packet.time, &ptime);
+	const int64_t seq = rec->data.packet.sequence;
+	const unsigned size = rec->size;
+#ifdef ENABLE_KUTIME
+	struct timespec stime;
+	ns_to_timespec(rec->data.packet.value, &stime);
+#endif
+
+	int len;
+	if (fmt->flags & SERVER_TSV_OUTPUT)
 	{
-		fprintf(stderr, "Could not bind listening socket.\n");
-		exit(EXIT_NETFAIL);
+#ifdef ENABLE_KUTIME
+		len = snprintf(buf, LOG_LINE_MAX, "%ld%06ld.%03ld\t"
+			       "%ld%06ld.%03ld\t%s\t%s\t%" PRId64 "\t%u\n",
+			       ptime.tv_sec, ptime.tv_nsec / NS_PER_US,
+			       ptime.tv_nsec % NS_PER_US,
+			       stime.tv_sec, stime.tv_nsec / NS_PER_US,
+			       stime.tv_nsec % NS_PER_US,
+			       addrstr, portstr, seq, size);
+#else
+		len = snprintf(buf, LOG_LINE_MAX,
+			       "%ld%06ld.%03ld\t%s\t%s\t%" PRId64 "\t%u\n",
+			       ptime.tv_sec, ptime.tv_nsec / NS_PER_US,
+			       ptime.tv_nsec % NS_PER_US,
+			       addrstr, portstr, seq, size);
+#endif
 	}
-	freeaddrinfo(addr); // no longer required
+	else
+	{
+		char tsstr[T_TIME_BUF];
+		struct tm tm;
+		localtime_r(&(ptime.tv_sec), &tm);
+		strftime(tsstr, T_TIME_BUF, "%T", &tm);
+#ifdef ENABLE_KUTIME
+		char tscstr[T_TIME_BUF];
+		localtime_r(&(stime.tv_sec), &tm);
+		strftime(tscstr, T_TIME_BUF, "%T", &tm);
+		len = snprintf(buf, LOG_LINE_MAX, "Received packet %" PRId64 " (%u "
+			       "bytes) from %s, port %s at %s.%09ld (kernel), "
+			       "%s.%09ld (user space).\n",
+			       seq, size, addrstr, portstr,
+			       tsstr, ptime.tv_nsec, tscstr, stime.tv_nsec);
+#else
+		len = snprintf(buf, LOG_LINE_MAX, "Received packet %" PRId64 " (%u "
+			       "bytes) from %s, port %s at %s.%09ld.\n",
+			       seq, size, addrstr, portstr,
+			       tsstr, ptime.tv_nsec);
+#endif
+	}
+	/* snprintf() returns the length the line would have had if
+	 * it was truncated */
+	return len < LOG_LINE_MAX ? len : LOG_LINE_MAX - 1;
+}
 
-	/* configure graceful exit on termination signals (SIGTERM,
-	 * SIGINT), if requested */
-	if (flags & SERVER_GRACEFUL_EXIT)
+
+
+/* Open the output file for the log writer, or return standard out if
+ * datafile is NULL. Sets *direct to 1 if the file could be opened
+ * with O_DIRECT (if requested). Receiver logs must be readable for
+ * merging. */
+static int open_output(const char *const datafile, const int flags,
+		       const int readable, int *const direct)
+{
+	*direct = 0;
+	if (datafile == NULL)
 	{
-		struct sigaction act;
-		memset(&act, 0, sizeof(struct sigaction));
-		act.sa_handler = term_server;
-		sigaction(SIGTERM, &act, NULL);
-		sigaction(SIGINT, &act, NULL);
+		/* anything written to stdout by stdio must appear
+		 * before the log */
+		fflush(stdout);
+		return STDOUT_FILENO;
 	}
 
-	/* Open output file if specified */
-	FILE *dataout = stdout;
-	if (datafile != NULL)
+	const int oflags = (readable ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+	int fd = -1;
+	if (flags & SERVER_DIRECT_IO)
+	{
+		fd = open(datafile, oflags | O_DIRECT, 0644);
+		if (fd != -1)
+			*direct = 1;
+		else if (errno == EINVAL)
+			fprintf(stderr, "The file system does not support "
+				"O_DIRECT, using buffered output.\n");
+	}
+	if (fd == -1)
+		fd = open(datafile, oflags, 0644);
+	if (fd == -1)
 	{
-		dataout = fopen(datafile, "w");
-		if (dataout == NULL)
+		perror("Opening output file in run_server");
+		exit(EXIT_FILEFAIL);
+	}
+	return fd;
+}
+
+
+
+/* Create a socket bound to the address. Returns the socket, or -1 if
+ * the address could not be used. */
+static int bind_socket(const struct addrinfo *const rp, const int flags,
+		       const int reuseport)
+{
+	/* inet6_only one must be a real variable so it can be used in
+	 * setsockopt. */
+	const int inet6_only = flags & SERVER_IPV6_ONLY;
+
+	const int sock = socket(rp->ai_family, rp->ai_socktype,
+				rp->ai_protocol);
+	if (sock == -1)
+		return -1;
+
+	if (rp->ai_family == AF_INET6)
+		if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY,
+			       &inet6_only, sizeof(inet6_only)) != 0)
 		{
-			perror("Opening output file in run_server");
-			exit(EXIT_FILEFAIL);
+			perror("setsockopt IPV6_V6ONLY");
+			exit(EXIT_NETFAIL);
 		}
+
+	/* all sockets of a multi-threaded server share the port, the
+	 * kernel distributes flows between them */
+	if (reuseport)
+		if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT,
+			       &reuseport, sizeof(reuseport)) != 0)
+		{
+			perror("setsockopt SO_REUSEPORT");
+			exit(EXIT_NETFAIL);
+		}
+
+	if (bind(sock, rp->ai_addr, rp->ai_addrlen) != 0)
+	{
+		close(sock);
+		return -1;
 	}
+	return sock;
+}
 
-	const size_t buflen = MSG_BUF_SIZE;
-	char *const buf = malloc(buflen);
-	CHKALLOC(buf);
-	touch_page(buf, buflen);
-	ssize_t recvlen = 0;
-	int seq = 0;
-	struct sockaddr *const addrbuf = malloc(ADDRBUF_SIZE);
-	CHKALLOC(addrbuf);
-	touch_page(addrbuf, ADDRBUF_SIZE);
-	socklen_t addrlen = 0;
-	char *const addrstr = malloc(ADDR_STR_LEN);
-	CHKALLOC(addrstr);
-	touch_page(addrstr, ADDR_STR_LEN);
-	char *const portstr = malloc(ADDR_STR_LEN);
-	CHKALLOC(portstr);
-	touch_page(portstr, ADDR_STR_LEN);
 
-	/* timestamp related data */
-	struct timeval ptime;
-	char *const tsstr = calloc(T_TIME_BUF, sizeof(char));
-	CHKALLOC(tsstr);
-	touch_page(tsstr, T_TIME_BUF);
+
+/* Attach a classic BPF program to the SO_REUSEPORT group of sock that
+ * selects the socket for each packet: by the CPU that processes the
+ * packet, so each receive thread handles the packets of the RX queue
+ * whose interrupts run on its CPU, or by the flow hash calculated by
+ * the NIC or kernel. */
+static void attach_steering(const int sock, const int steer,
+			    const int threads)
+{
+	const uint32_t ancillary = steer == SERVER_STEER_CPU ?
+		SKF_AD_CPU : SKF_AD_RXHASH;
+	struct sock_filter code[] = {
+		/* A = CPU number or flow hash */
+		{BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + ancillary},
+		/* A = A % threads */
+		{BPF_ALU | BPF_MOD | BPF_K, 0, 0, threads},
+		/* return A, the index of the socket in the group */
+		{BPF_RET | BPF_A, 0, 0, 0},
+	};
+	struct sock_fprog prog = {
+		.len = sizeof(code) / sizeof(code[0]),
+		.filter = code,
+	};
+	if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+		       &prog, sizeof(prog)) != 0)
+	{
+		perror("setsockopt SO_ATTACH_REUSEPORT_CBPF");
+		exit(EXIT_NETFAIL);
+	}
+}
+
+
+
+/* Create a log writer for the given format flags, writing the
+ * matching header first */
+static struct log_writer *create_writer(const int fd, const int direct,
+					const int flags,
+					struct text_format *const fmt)
+{
+	if (flags & SERVER_BINARY_OUTPUT)
+	{
+		struct binlog_header hdr;
 #ifdef ENABLE_KUTIME
-	struct timeval stime;
-	char *const tscstr = calloc(T_TIME_BUF, sizeof(char));
-	CHKALLOC(tscstr);
-	touch_page(tscstr, T_TIME_BUF);
+		binlog_init_header(&hdr, BINLOG_TYPE_SERVER,
+				   BINLOG_FLAG_KUTIME);
+#else
+		binlog_init_header(&hdr, BINLOG_TYPE_SERVER, 0);
 #endif
-	/* *tm will be used to point to localtime's statically
-	 * allocated memory, does not need to be allocated/freed
-	 * manually */
-	const struct tm *tm;
-	/* Call localtime to make sure its internal memory structures
-	 * get initialized. The result doesn't matter. */
-	localtime(&(ptime.tv_sec));
+		return log_writer_create(fd, direct, NULL, NULL,
+					 &hdr, sizeof(hdr));
+	}
 
-	/* Set up output. Allocating memory for time_trans is not
-	 * necessary because the following if/else will point it at a
-	 * fixed string ("%s" or "%T"). */
-	const char *time_trans;
+	const char *tsv_header = "";
 	if (flags & SERVER_TSV_OUTPUT)
-	{
 #ifdef ENABLE_KUTIME
-		fprintf(dataout,
-			"# ktime\tutime\tsource\tport\tsequence\tsize\n");
+		tsv_header = "# ktime\tutime\tsource\tport\t"
+			"sequence\tsize\n";
 #else
-		fprintf(dataout, "# ktime\tsource\tport\tsequence\tsize\n");
+		tsv_header = "# ktime\tsource\tport\tsequence\t"
+			"size\n";
 #endif
-		time_trans = "%s";
+	return log_writer_create(fd, direct, &format_record, fmt,
+				 tsv_header, strlen(tsv_header));
+}
+
+
+
+/* Set up text formatting for up to max_flows flows */
+static void init_text_format(struct text_format *const fmt, const int flags,
+			     const uint32_t max_flows)
+{
+	fmt->flags = flags;
+	fmt->max_flows = max_flows;
+	fmt->names = calloc(max_flows + 1, sizeof(struct binlog_flow_names));
+	CHKALLOC(fmt->names);
+}
+
+
+
+/* Write a description of a flow seen by the receiver to buf */
+static void flow_name(const struct receiver *const r, const uint32_t id,
+		      char *const buf, const size_t len)
+{
+	const struct flow_slot *const slot = flow_table_get(&(r->flows), id);
+	char addrstr[BINLOG_NAME_LEN];
+	char portstr[BINLOG_NAME_LEN];
+	if (getnameinfo((const struct sockaddr *) slot->addr, slot->addrlen,
+			addrstr, BINLOG_NAME_LEN, portstr, BINLOG_NAME_LEN,
+			NI_DGRAM | NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+	{
+		strcpy(addrstr, "?");
+		strcpy(portstr, "?");
 	}
+	if (r->threads > 1)
+		snprintf(buf, len, "Receiver %i, flow %u (%s port %s)",
+			 r->id, id, addrstr, portstr);
 	else
-		time_trans = "%T";
+		snprintf(buf, len, "Flow %u (%s port %s)",
+			 id, addrstr, portstr);
+}
+
+
+
+/* Report the statistics of all flows of the receiver to stderr, since
+ * the start (total != 0) or for flows that received packets since
+ * the last interval report (total == 0) */
+static void report_stats(struct receiver *const r, const int total)
+{
+	char name[2 * BINLOG_NAME_LEN + 64];
+	for (uint32_t id = 0; id < r->flows.count; id++)
+	{
+		struct flow_stats *const stats = &(r->stats[id]);
+		if (!total && stats->c.received == stats->last.received)
+			continue;
+		flow_name(r, id, name, sizeof(name));
+		flow_stats_report(stderr, name, stats, total);
+	}
+	if (total && r->untracked > 0)
+		fprintf(stderr, "%i: %" PRId64 " packets from flows that did "
+			"not fit into the flow table\n", r->id, r->untracked);
+}
+
+
+
+/* Receive loop of one receiver, runs until work is set to 0 */
+void *receiver_thread(void *arg)
+{
+	struct receiver *const r = (struct receiver *) arg;
+	const int sock = r->sock;
+	struct log_writer *const writer = r->writer;
+
+	if (r->cpu >= 0)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(r->cpu, &cpus);
+		const int ret = pthread_setaffinity_np(pthread_self(),
+						       sizeof(cpu_set_t),
+						       &cpus);
+		if (ret != 0)
+			fprintf(stderr, "Could not pin receiver %i to CPU %i: "
+				"%s\n", r->id, r->cpu, strerror(ret));
+	}
+
+	/* Request nanosecond kernel receive timestamps, delivered as
+	 * control messages along with each packet. */
+	const int tsopt = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS,
+		       &tsopt, sizeof(tsopt)) != 0)
+	{
+		perror("setsockopt SO_TIMESTAMPNS");
+		exit(EXIT_NETFAIL);
+	}
+
+	/* buffers for one batch of packets */
+	char *const bufs = malloc(SERVER_RECV_BATCH * MSG_BUF_SIZE);
+	CHKALLOC(bufs);
+	touch_page(bufs, SERVER_RECV_BATCH * MSG_BUF_SIZE);
+	char *const addrbufs = malloc(SERVER_RECV_BATCH * ADDRBUF_SIZE);
+	CHKALLOC(addrbufs);
+	touch_page(addrbufs, SERVER_RECV_BATCH * ADDRBUF_SIZE);
+	char *const cbufs = calloc(SERVER_RECV_BATCH, RECV_CMSG_SIZE);
+	CHKALLOC(cbufs);
+	touch_page(cbufs, SERVER_RECV_BATCH * RECV_CMSG_SIZE);
+	struct iovec *const iovs =
+		calloc(SERVER_RECV_BATCH, sizeof(struct iovec));
+	CHKALLOC(iovs);
+	touch_page(iovs, SERVER_RECV_BATCH * sizeof(struct iovec));
+	struct mmsghdr *const msgs =
+		calloc(SERVER_RECV_BATCH, sizeof(struct mmsghdr));
+	CHKALLOC(msgs);
+	touch_page(msgs, SERVER_RECV_BATCH * sizeof(struct mmsghdr));
+	/* echo replies point into the receive buffers, they only need
+	 * their own iovecs to set the length */
+	struct iovec *const echo_iovs =
+		calloc(SERVER_RECV_BATCH, sizeof(struct iovec));
+	CHKALLOC(echo_iovs);
+	touch_page(echo_iovs, SERVER_RECV_BATCH * sizeof(struct iovec));
+	struct mmsghdr *const echo_msgs =
+		calloc(SERVER_RECV_BATCH, sizeof(struct mmsghdr));
+	CHKALLOC(echo_msgs);
+	touch_page(echo_msgs, SERVER_RECV_BATCH * sizeof(struct mmsghdr));
+	/* echoes that get server timestamps, and their headers */
+	char *stamped[SERVER_RECV_BATCH];
+	struct packet_header stamped_hdrs[SERVER_RECV_BATCH];
+	for (int i = 0; i < SERVER_RECV_BATCH; i++)
+	{
+		iovs[i].iov_base = bufs + i * MSG_BUF_SIZE;
+		iovs[i].iov_len = MSG_BUF_SIZE;
+		msgs[i].msg_hdr.msg_name = addrbufs + i * ADDRBUF_SIZE;
+		msgs[i].msg_hdr.msg_iov = &(iovs[i]);
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = cbufs + i * RECV_CMSG_SIZE;
+		echo_msgs[i].msg_hdr.msg_iov = &(echo_iovs[i]);
+		echo_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ssize_t recvlen = 0;
+	struct packet_header phdr;
+	struct binlog_record rec;
+
+	/* timestamp related data */
+	struct timespec ptime = {0, 0};
+#ifdef ENABLE_KUTIME
+	struct timespec stime;
+#endif
+	/* time of the next statistics report (monotonic clock) */
+	struct timespec now;
+	struct timespec next_report;
+	const struct timespec report_interval = {r->stats_interval, 0};
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecadd(&now, &report_interval, &next_report);
 
 	/* Store page fault statistics to check if memory management
 	 * is working properly */
 	struct rusage usage_pre;
 	struct rusage usage_post;
-	getrusage(RUSAGE_SELF, &usage_pre);
+	getrusage(RUSAGE_THREAD, &usage_pre);
 
 	while (work)
 	{
-		addrlen = ADDRBUF_SIZE;
-		recvlen = recvfrom(sock, buf, buflen, 0, addrbuf, &addrlen);
+		/* reset the lengths the previous call has changed */
+		for (int i = 0; i < SERVER_RECV_BATCH; i++)
+		{
+			msgs[i].msg_hdr.msg_namelen = ADDRBUF_SIZE;
+			msgs[i].msg_hdr.msg_controllen = RECV_CMSG_SIZE;
+		}
+		/* With MSG_WAITFORONE recvmmsg() blocks until one
+		 * packet is available, and then returns whatever else
+		 * is already queued up to the batch size. */
+		const int count = recvmmsg(sock, msgs, SERVER_RECV_BATCH,
+					   MSG_WAITFORONE, NULL);
 #ifdef ENABLE_KUTIME
-		gettimeofday(&stime, NULL);
+		clock_gettime(CLOCK_REALTIME, &stime);
 #endif
-		/* ensure minimum packet size */
-		if (recvlen < MIN_PACKET_SIZE)
+		if (r->stats_interval > 0)
 		{
-			fprintf(stderr, "Only %ld bytes received, "
-				"smaller than minimum protocol size! "
-				"Ignoring packet.\n", recvlen);
-			continue;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (timespec_to_ns(&now) >= timespec_to_ns(&next_report))
+			{
+				report_stats(r, 0);
+				timespecadd(&now, &report_interval,
+					    &next_report);
+			}
 		}
-		/* This only occurs when recvfrom() is interrupted. */
-		if (recvlen == -1)
+		/* This only occurs when recvmmsg() is interrupted, or
+		 * times out in multi-threaded mode. */
+		if (count == -1)
 			continue;
 
-		/* echo packet if echo flag is set */
-		if (buf[sizeof(int) + sizeof(struct timespec)]
-		    & LUNA_FLAG_ECHO)
-			sendto(sock, buf, recvlen, 0, addrbuf, addrlen);
-
-		/* get kernel timestamp */
-		ioctl(sock, SIOCGSTAMP, &ptime); // TODO: error check
+		/* echo packets if the echo flag is set, before
+		 * spending any time on the log */
+		int echo_count = 0;
+		int stamp_count = 0;
+		for (int i = 0; i < count; i++)
+		{
+			char *const buf = iovs[i].iov_base;
+			if (packet_read_header(buf, msgs[i].msg_len, &phdr) != 0
+			    || !(phdr.flags & (LUNA_FLAG_ECHO | LUNA_FLAG_HELLO)))
+				continue;
+			size_t echo_len = msgs[i].msg_len;
+			if (phdr.flags & LUNA_FLAG_HELLO)
+			{
+				/* answer protocol negotiation with
+				 * the highest version supported, the
+				 * reply is not logged */
+				const struct packet_header hello = {
+					.sequence = PROTOCOL_HELLO_SEQ,
+					.send_time = 0,
+					.flow = 0,
+					.flags = LUNA_FLAG_HELLO,
+					.version = PROTOCOL_VERSION,
+					.length = PROTOCOL_V2_HEADER_SIZE
+				};
+				packet_write_header(buf, &hello);
+				echo_len = PROTOCOL_V2_HEADER_SIZE;
+			}
+			/* insert the receive timestamp, the send
+			 * timestamp follows below */
+			else if (phdr.flags & LUNA_FLAG_STAMPS
+				 && msgs[i].msg_len >= packet_stamped_size(&phdr)
+				 && packet_timestamp(&(msgs[i].msg_hdr), &ptime)
+				 == 0)
+			{
+				packet_write_stamp(buf, &phdr, 0,
+						   timespec_to_ns(&ptime));
+				stamped[stamp_count] = buf;
+				stamped_hdrs[stamp_count++] = phdr;
+			}
+			echo_iovs[echo_count].iov_base = iovs[i].iov_base;
+			echo_iovs[echo_count].iov_len = echo_len;
+			echo_msgs[echo_count].msg_hdr.msg_name =
+				msgs[i].msg_hdr.msg_name;
+			echo_msgs[echo_count].msg_hdr.msg_namelen =
+				msgs[i].msg_hdr.msg_namelen;
+			echo_count++;
+		}
+		if (stamp_count > 0)
+		{
+			/* all echoes of the batch are sent with one
+			 * call, so they share the send timestamp */
+			clock_gettime(CLOCK_REALTIME, &ptime);
+			const int64_t sendtime = timespec_to_ns(&ptime);
+			for (int i = 0; i < stamp_count; i++)
+				packet_write_stamp(stamped[i],
+						   &(stamped_hdrs[i]), 1,
+						   sendtime);
+		}
+		if (echo_count > 0)
+			sendmmsg(sock, echo_msgs, echo_count, 0);
 
-		if (addrlen > ADDRBUF_SIZE)
-			fprintf(stderr, "recv: addr buffer too small!\n");
-		/* Create strings for source address and port, disable
-		 * name resolution (would require DNS requests). */
-		getnameinfo(addrbuf, addrlen,
-			    addrstr, ADDR_STR_LEN,
-			    portstr, ADDR_STR_LEN,
-			    NI_DGRAM | NI_NUMERICHOST | NI_NUMERICSERV); // TODO: error check
+		for (int i = 0; i < count; i++)
+		{
+			const struct msghdr *const hdr = &(msgs[i].msg_hdr);
+			const char *const buf = iovs[i].iov_base;
+			recvlen = msgs[i].msg_len;
+			/* ensure minimum packet size */
+			if (packet_read_header(buf, recvlen, &phdr) != 0)
+			{
+				fprintf(stderr, "Only %ld bytes received, "
+					"smaller than minimum protocol size! "
+					"Ignoring packet.\n", recvlen);
+				continue;
+			}
+			/* negotiation packets have been answered
+			 * above */
+			if (phdr.flags & LUNA_FLAG_HELLO)
+				continue;
 
-		seq = ntohl(*((int *) buf));
+			/* get kernel timestamp */
+			if (packet_timestamp(hdr, &ptime) != 0)
+				fprintf(stderr, "recv: no kernel timestamp "
+					"for packet!\n");
 
-		tm = localtime(&(ptime.tv_sec));
-		strftime(tsstr, T_TIME_BUF, time_trans, tm);
-#ifdef ENABLE_KUTIME
-		tm = localtime(&(stime.tv_sec));
-		strftime(tscstr, T_TIME_BUF, time_trans, tm);
-#endif
+			if (hdr->msg_namelen > ADDRBUF_SIZE)
+				fprintf(stderr,
+					"recv: addr buffer too small!\n");
 
-		if (flags & SERVER_TSV_OUTPUT)
-		{
-#ifdef ENABLE_KUTIME
-			fprintf(dataout, "%s%06ld\t%s%06ld\t%s\t%s\t%i\t%ld\n",
-			       tsstr, ptime.tv_usec, tscstr, stime.tv_usec,
-			       addrstr, portstr, seq, recvlen);
-#else
-			fprintf(dataout, "%s%06ld\t%s\t%s\t%i\t%ld\n",
-			       tsstr, ptime.tv_usec,
-			       addrstr, portstr, seq, recvlen);
-#endif
-		}
-		else
-		{
+			const uint32_t flow = flow_id(&(r->flows),
+						      hdr->msg_name,
+						      hdr->msg_namelen,
+						      writer);
+			if (flow == BINLOG_FLOW_OTHER)
+				r->untracked++;
+			else
+				flow_stats_update(&(r->stats[flow]),
+						  phdr.sequence,
+						  timespec_to_ns(&ptime),
+						  phdr.send_time);
+			if (writer == NULL)
+				continue;
 #ifdef ENABLE_KUTIME
-			fprintf(dataout, "Received packet %i (%i bytes) from "
-				"%s, port %s at %s.%06ld (kernel), %s.%06ld "
-				"(user space).\n",
-				seq, (int) recvlen, addrstr, portstr, tsstr,
-				ptime.tv_usec, tscstr, stime.tv_usec);
+			binlog_fill_packet(&rec, flow, phdr.flags, &ptime,
+					   timespec_to_ns(&stime),
+					   phdr.sequence, recvlen);
 #else
-			fprintf(dataout, "Received packet %i (%i bytes) from "
-				"%s, port %s at %s.%06ld.\n",
-				seq, (int) recvlen, addrstr, portstr, tsstr,
-				ptime.tv_usec);
+			binlog_fill_packet(&rec, flow, phdr.flags, &ptime, 0,
+					   phdr.sequence, recvlen);
 #endif
+			log_writer_push(writer, &rec);
 		}
 	}
 
 	/* Check page fault statistics to see if memory management is
 	 * working properly */
-	getrusage(RUSAGE_SELF, &usage_post);
+	getrusage(RUSAGE_THREAD, &usage_post);
 	if (check_pfaults(&usage_pre, &usage_post))
 		fprintf(stderr,
-			"WARNING: Page faults occurred in real-time section!\n"
+			"WARNING: Page faults occurred in real-time section "
+			"(receiver %i)!\n"
 			"Pre:  Major-pagefaults: %ld, Minor Pagefaults: %ld\n"
 			"Post: Major-pagefaults: %ld, Minor Pagefaults: %ld\n",
-			usage_pre.ru_majflt, usage_pre.ru_minflt,
+			r->id, usage_pre.ru_majflt, usage_pre.ru_minflt,
 			usage_post.ru_majflt, usage_post.ru_minflt);
 
-	fflush(NULL);
-	free(tsstr);
-#ifdef ENABLE_KUTIME
-	free(tscstr);
-#endif
-	free(addrbuf);
-	free(addrstr);
-	free(portstr);
-	free(buf);
-	if (datafile != NULL)
-		fclose(dataout);
-	close(sock);
+	free(echo_msgs);
+	free(echo_iovs);
+	free(msgs);
+	free(iovs);
+	free(cbufs);
+	free(addrbufs);
+	free(bufs);
+	return NULL;
+}
+
+
+
+/* Read the next record of a part log into *rec, returns 0 on success
+ * and -1 at the end of the log */
+static int next_record(FILE *const part, struct binlog_record *const rec)
+{
+	return fread(rec, sizeof(struct binlog_record), 1, part) == 1 ? 0 : -1;
+}
+
+
+
+/* Merge the binary logs of the receivers by timestamp into the output.
+ * Flow IDs are local to each receiver and get remapped to IDs unique
+ * in the output. */
+static void merge_logs(struct receiver *const receivers, const int threads,
+		       const int outfd, const int flags)
+{
+	FILE **const parts = calloc(threads, sizeof(FILE *));
+	CHKALLOC(parts);
+	struct binlog_record *const heads =
+		calloc(threads, sizeof(struct binlog_record));
+	CHKALLOC(heads);
+	int *const valid = calloc(threads, sizeof(int));
+	CHKALLOC(valid);
+	uint32_t *const remap = calloc(threads * SERVER_MAX_FLOWS,
+				       sizeof(uint32_t));
+	CHKALLOC(remap);
+	uint32_t flows = 0;
+
+	for (int i = 0; i < threads; i++)
+	{
+		if (lseek(receivers[i].partfd, 0, SEEK_SET) == -1
+		    || (parts[i] = fdopen(receivers[i].partfd, "r")) == NULL)
+		{
+			perror("Reading receiver log");
+			exit(EXIT_FILEFAIL);
+		}
+		setvbuf(parts[i], NULL, _IOFBF, BINLOG_BUF_SIZE);
+		struct binlog_header hdr;
+		if (binlog_read_header(parts[i], &hdr) != 0)
+			exit(EXIT_FILEFAIL);
+		valid[i] = next_record(parts[i], &(heads[i])) == 0;
+	}
+
+	/* The merge does not run in real-time, so it uses a plain
+	 * log writer without O_DIRECT, and waits if the ring is
+	 * full. */
+	struct text_format fmt;
+	init_text_format(&fmt, flags, threads * SERVER_MAX_FLOWS);
+	struct log_writer *const writer = create_writer(outfd, 0, flags, &fmt);
+	const struct timespec wait = {0, LOG_WRITER_POLL};
+
+	while (1)
+	{
+		/* Flow records have no timestamp, but always precede
+		 * the packets of their flow, pass them on right
+		 * away. Find the oldest packet otherwise. */
+		int next = -1;
+		for (int i = 0; i < threads; i++)
+		{
+			while (valid[i] && heads[i].type == BINLOG_REC_FLOW)
+			{
+				struct binlog_record *const rec = &(heads[i]);
+				if (rec->flow != BINLOG_FLOW_OTHER)
+				{
+					remap[i * SERVER_MAX_FLOWS + rec->flow] =
+						flows;
+					rec->flow = flows++;
+				}
+				while (log_writer_push(writer, rec) != 0)
+					nanosleep(&wait, NULL);
+				valid[i] = next_record(parts[i], rec) == 0;
+			}
+			if (valid[i] && (next == -1
+					 || heads[i].data.packet.time <
+					 heads[next].data.packet.time))
+				next = i;
+		}
+		if (next == -1)
+			break;
+
+		struct binlog_record *const rec = &(heads[next]);
+		if (rec->flow != BINLOG_FLOW_OTHER)
+			rec->flow = remap[next * SERVER_MAX_FLOWS + rec->flow];
+		while (log_writer_push(writer, rec) != 0)
+			nanosleep(&wait, NULL);
+		valid[next] = next_record(parts[next], rec) == 0;
+	}
+	log_writer_close(writer, NULL);
+
+	for (int i = 0; i < threads; i++)
+	{
+		fclose(parts[i]);
+		if (receivers[i].partpath != NULL)
+			unlink(receivers[i].partpath);
+	}
+	free(fmt.names);
+	free(remap);
+	free(valid);
+	free(heads);
+	free(parts);
+}
+
+
+
+int run_server(struct addrinfo *const addr,
+	       const struct server_config *const config)
+{
+	const int flags = config->flags;
+	const int threads = config->threads;
+	struct receiver *const receivers =
+		calloc(threads, sizeof(struct receiver));
+	CHKALLOC(receivers);
+	for (int i = 0; i < threads; i++)
+	{
+		struct receiver *const r = &(receivers[i]);
+		r->threads = threads;
+		r->stats_interval = config->stats_interval;
+		flow_table_init(&(r->flows));
+		r->stats = calloc(SERVER_MAX_FLOWS, sizeof(struct flow_stats));
+		CHKALLOC(r->stats);
+		touch_page(r->stats,
+			   SERVER_MAX_FLOWS * sizeof(struct flow_stats));
+	}
+
+	/* create the sockets, the first one determines the address
+	 * the others use */
+	const struct addrinfo *rp;
+	for (rp = addr; rp != NULL; rp = rp->ai_next)
+	{
+		receivers[0].sock = bind_socket(rp, flags, threads > 1);
+		if (receivers[0].sock != -1)
+			break; // connected (well, it's UDP, but...)
+	}
+	if (rp == NULL)
+	{
+		fprintf(stderr, "Could not bind listening socket.\n");
+		exit(EXIT_NETFAIL);
+	}
+	for (int i = 1; i < threads; i++)
+	{
+		receivers[i].sock = bind_socket(rp, flags, 1);
+		if (receivers[i].sock == -1)
+		{
+			perror("Could not bind listening socket");
+			exit(EXIT_NETFAIL);
+		}
+	}
+	freeaddrinfo(addr); // no longer required
+	if (threads > 1 && config->steer != SERVER_STEER_NONE)
+		attach_steering(receivers[0].sock, config->steer, threads);
+
+	/* configure graceful exit on termination signals (SIGTERM,
+	 * SIGINT), if requested */
+	if (flags & SERVER_GRACEFUL_EXIT)
+	{
+		struct sigaction act;
+		memset(&act, 0, sizeof(struct sigaction));
+		act.sa_handler = term_server;
+		sigaction(SIGTERM, &act, NULL);
+		sigaction(SIGINT, &act, NULL);
+	}
+
+	/* Set up output. A single receiver writes the output directly,
+	 * multiple receivers write binary logs that are merged when
+	 * the server stops. Without output only the flow statistics
+	 * are kept. */
+	const int output = !(flags & SERVER_NO_OUTPUT);
+	struct text_format fmt;
+	init_text_format(&fmt, flags, SERVER_MAX_FLOWS);
+	/* Call localtime to make sure its internal memory structures
+	 * get initialized. The result doesn't matter. */
+	const time_t now = time(NULL);
+	struct tm tm;
+	localtime_r(&now, &tm);
+
+	int direct = 0;
+	const int outfd = !output ? -1
+		: open_output(config->datafile,
+			      threads > 1 ? flags & ~SERVER_DIRECT_IO : flags,
+			      0, &direct);
+	if (threads == 1)
+	{
+		receivers[0].cpu = -1;
+		if (output)
+			receivers[0].writer =
+				create_writer(outfd, direct, flags, &fmt);
+		receiver_thread(&(receivers[0]));
+		if (output)
+			log_writer_close(receivers[0].writer, "Log");
+	}
+	else
+	{
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		/* The receive threads must not get termination
+		 * signals, the main thread waits for them. */
+		sigset_t stop_signals;
+		sigset_t old_mask;
+		sigemptyset(&stop_signals);
+		sigaddset(&stop_signals, SIGTERM);
+		sigaddset(&stop_signals, SIGINT);
+		pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+
+		const struct timeval timeout = {0, SERVER_STOP_POLL};
+		for (int i = 0; i < threads; i++)
+		{
+			struct receiver *const r = &(receivers[i]);
+			r->id = i;
+			r->cpu = i % cpus;
+			if (setsockopt(r->sock, SOL_SOCKET, SO_RCVTIMEO,
+				       &timeout, sizeof(timeout)) != 0)
+			{
+				perror("setsockopt SO_RCVTIMEO");
+				exit(EXIT_NETFAIL);
+			}
+
+			/* per-receiver logs go next to the output
+			 * file, or to temporary files */
+			int part_direct = 0;
+			if (!output)
+				r->partfd = -1;
+			else if (config->datafile != NULL)
+			{
+				const size_t len =
+					strlen(config->datafile) + 16;
+				r->partpath = malloc(len);
+				CHKALLOC(r->partpath);
+				snprintf(r->partpath, len, "%s.%i",
+					 config->datafile, i);
+				r->partfd = open_output(r->partpath, flags, 1,
+							&part_direct);
+			}
+			else
+			{
+				FILE *const tmp = tmpfile();
+				if (tmp == NULL)
+				{
+					perror("Creating receiver log");
+					exit(EXIT_FILEFAIL);
+				}
+				r->partfd = dup(fileno(tmp));
+				fclose(tmp);
+			}
+			if (output)
+				r->writer = create_writer(
+					r->partfd, part_direct,
+					flags | SERVER_BINARY_OUTPUT, NULL);
+
+			const int ret = pthread_create(&(r->thread), NULL,
+						       &receiver_thread, r);
+			if (ret != 0)
+			{
+				fprintf(stderr, "creating receive thread "
+					"failed: %s\n", strerror(ret));
+				exit(1);
+			}
+			fprintf(stderr, "Receiver %i: CPU %i\n", i, r->cpu);
+		}
+
+		/* wait for a termination signal */
+		sigset_t wait_mask = old_mask;
+		sigdelset(&wait_mask, SIGTERM);
+		sigdelset(&wait_mask, SIGINT);
+		while (work)
+			sigsuspend(&wait_mask);
+		pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+		for (int i = 0; i < threads; i++)
+		{
+			char name[32];
+			snprintf(name, sizeof(name), "Receiver %i log", i);
+			pthread_join(receivers[i].thread, NULL);
+			if (output)
+				log_writer_close(receivers[i].writer, name);
+		}
+		if (output)
+			merge_logs(receivers, threads, outfd, flags);
+	}
+
+	for (int i = 0; i < threads; i++)
+		report_stats(&(receivers[i]), 1);
+
+	if (output && config->datafile != NULL && close(outfd) != 0)
+	{
+		perror("Closing output file in run_server");
+		exit(EXIT_FILEFAIL);
+	}
+	for (int i = 0; i < threads; i++)
+	{
+		close(receivers[i].sock);
+		free(receivers[i].partpath);
+		flow_table_destroy(&(receivers[i].flows));
+		free(receivers[i].stats);
+	}
+	free(fmt.names);
+	free(receivers);
 	return 0;
 }
 
@@ -19,15 +19,49 @@
 #ifndef __LUNA_SERVER_H_
 #define __LUNA_SERVER_H_
 
+#include <netdb.h>
 #include <netinet/in.h>
 
 /* option flags for the server */
 #define SERVER_IPV6_ONLY 1
 #define SERVER_TSV_OUTPUT 2
 #define SERVER_GRACEFUL_EXIT 4
+#define SERVER_BINARY_OUTPUT 8
+#define SERVER_DIRECT_IO 16
+/* keep only the flow statistics, no per-packet log */
+#define SERVER_NO_OUTPUT 32
 
-int run_server(struct addrinfo *const addr, const int flags,
-	       const char *const datafile);
+/* how packets are distributed between receive threads */
+/* kernel default (hash of addresses and ports) */
+#define SERVER_STEER_NONE 0
+/* by the flow hash of the packet */
+#define SERVER_STEER_HASH 1
+/* by the CPU the packet is processed on */
+#define SERVER_STEER_CPU 2
+
+/*
+ * Server settings:
+ *
+ * flags: SERVER_* option flags
+ * datafile: file to write the log to, NULL for standard out
+ * threads: number of receive threads, each with its own SO_REUSEPORT
+ *	    socket
+ * steer: SERVER_STEER_* policy for distributing packets between
+ *	  receive threads
+ * stats_interval: interval for per-flow statistics reports on stderr
+ *		   (s), 0 for a summary at the end only
+ */
+struct server_config
+{
+	int flags;
+	const char *datafile;
+	int threads;
+	int steer;
+	int stats_interval;
+};
+
+int run_server(struct addrinfo *const addr,
+	       const struct server_config *const config);
 
 void term_server(int signum);
 
@@ -22,9 +22,11 @@
 #include <time.h>
 
 #include "luna.h"
+#include "rng.h"
 #include "simple_generator.h"
 
-/* TODO: meaningful block length */
+/* Length of the blocks of the static generators, alt_time switches
+ * between its intervals after each block */
 #define BLOCK_LEN 10
 
 int static_generator_init(generator_t *this);
@@ -39,6 +41,9 @@ struct static_generator_attr
 {
 	int size;
 	struct timespec interval;
+	/* only used by the random_size generator */
+	struct rng rng;
+	double *values;
 };
 
 
@@ -52,11 +57,14 @@ struct static_generator_attr
  *
  * interval (i): time between two packets (µs)
  * size (s): packet size in bytes (must be at least 4)
+ * seed: seed for the random number generator, default
+ *	 RNG_DEFAULT_SEED
  */
 static int simple_generator_base(generator_t *this, generator_option *args)
 {
 	int size = MIN_PACKET_SIZE;
 	int interval = 1000;
+	unsigned long seed = RNG_DEFAULT_SEED;
 
 	if (args != NULL)
 	{
@@ -70,6 +78,8 @@ static int simple_generator_base(generator_t *this, generator_option *args)
 			if (strcmp(name, "interval") == 0
 			    || strcmp(name, "i") == 0)
 				interval = atoi(value);
+			if (strcmp(name, "seed") == 0)
+				seed = strtoul(value, NULL, 10);
 			// TODO: catch unknown params
 		}
 	}
@@ -86,6 +96,8 @@ static int simple_generator_base(generator_t *this, generator_option *args)
 	attr->size = size;
 	attr->interval.tv_sec = interval / US_PER_S;
 	attr->interval.tv_nsec = (interval % US_PER_S) * 1000;
+	rng_seed(&(attr->rng), seed, this->id);
+	attr->values = NULL;
 	return 0;
 }
 
@@ -129,7 +141,7 @@ int static_generator_init(generator_t *this)
 	struct static_generator_attr *attr =
 		(struct static_generator_attr *) this->attr;
 
-	this->block = create_block_circle(1, BLOCK_LEN);
+	this->block = create_block_circle(this, 1, BLOCK_LEN);
 
 	struct packet_block *block = this->block;
 	for (int i = 0; i < block->length; i++)
@@ -151,7 +163,7 @@ int alternate_time_generator_init(generator_t *this)
 	struct static_generator_attr *attr =
 		(struct static_generator_attr *) this->attr;
 
-	this->block = create_block_circle(2, BLOCK_LEN);
+	this->block = create_block_circle(this, 2, BLOCK_LEN);
 
 	struct timespec alt_interval;
 	alt_interval.tv_sec = attr->interval.tv_sec * 2;
@@ -194,7 +206,10 @@ int rand_size_generator_init(generator_t *this)
 	struct static_generator_attr *attr =
 		(struct static_generator_attr *) this->attr;
 
-	this->block = create_block_circle(4, BLOCK_LEN);
+	this->block = create_sized_block_circle
+		(this, timespec_to_ns(&(attr->interval)));
+	attr->values = malloc(this->block->length * sizeof(double));
+	CHKALLOC(attr->values);
 
 	struct packet_block *block = this->block;
 	do
@@ -216,12 +231,13 @@ int rand_size_generator_fill_block(generator_t *this,
 	struct static_generator_attr *attr =
 		(struct static_generator_attr *) this->attr;
 
+	rng_uniform(&(attr->rng), attr->values, current->length);
 	for (int i = 0; i < current->length; i++)
 	{
 		/* scale random number to range of MIN_PACKET_SIZE to
 		 * attr->size */
-		long int r = random() * (attr->size - MIN_PACKET_SIZE)
-			/ RAND_MAX + MIN_PACKET_SIZE;
+		long int r = attr->values[i]
+			* (attr->size - MIN_PACKET_SIZE + 1) + MIN_PACKET_SIZE;
 		current->data[i].size = r;
 		memcpy(&(current->data[i].delay), &(attr->interval),
 		       sizeof(struct timespec));
@@ -234,8 +250,11 @@ int rand_size_generator_fill_block(generator_t *this,
 
 int static_generator_destroy(generator_t *this)
 {
+	struct static_generator_attr *attr =
+		(struct static_generator_attr *) this->attr;
 	int ret = destroy_block_circle(this->block);
 	this->block = NULL;
+	free(attr->values);
 	free(this->attr);
 	return ret;
 }
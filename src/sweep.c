@@ -0,0 +1,74 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include "sweep.h"
+
+
+
+void sweep_init(struct sweep *const sweep, const double min,
+		const double max, const double step)
+{
+	sweep->min = min;
+	sweep->max = max;
+	sweep->step = step;
+	sweep->steps = 0;
+	sweep->best = 0;
+	sweep->fail = 0;
+}
+
+
+
+double sweep_next(const struct sweep *const sweep)
+{
+	if (sweep->step > 0)
+	{
+		/* linear sweep, stop at the first failure */
+		if (sweep->fail > 0)
+			return 0;
+		const double rate = sweep->min + sweep->steps * sweep->step;
+		/* allow for rounding errors in the sum */
+		return rate <= sweep->max * (1 + SWEEP_PRECISION / 2) ?
+			rate : 0;
+	}
+
+	if (sweep->steps == 0)
+		return sweep->min;
+	/* even the minimum failed */
+	if (sweep->best == 0)
+		return 0;
+	if (sweep->fail == 0)
+		return sweep->best < sweep->max ? sweep->max : 0;
+	if (sweep->steps >= SWEEP_MAX_STEPS
+	    || sweep->fail - sweep->best <= sweep->best * SWEEP_PRECISION)
+		return 0;
+	return (sweep->best + sweep->fail) / 2;
+}
+
+
+
+void sweep_result(struct sweep *const sweep, const double rate,
+		  const int ok)
+{
+	sweep->steps++;
+	if (ok && rate > sweep->best)
+		sweep->best = rate;
+	else if (!ok && (sweep->fail == 0 || rate < sweep->fail))
+		sweep->fail = rate;
+}
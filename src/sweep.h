@@ -0,0 +1,62 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_SWEEP_H__
+#define __LUNA_SWEEP_H__
+
+/* A binary search stops when the lowest failing rate is less than
+ * this fraction above the highest passing one, or after
+ * SWEEP_MAX_STEPS steps */
+#define SWEEP_PRECISION 0.01
+#define SWEEP_MAX_STEPS 32
+
+/*
+ * Search for the highest send rate (packets/s) that meets a loss and
+ * latency objective. Whether a step met it is decided by the caller.
+ *
+ * With a step size, the rates min, min + step, ... up to max are
+ * tried until one fails (linear sweep). Without a step size, min and
+ * max are tried first, then the search bisects the interval between
+ * the highest passing and the lowest failing rate.
+ */
+struct sweep
+{
+	double min;
+	double max;
+	/* 0 for binary search */
+	double step;
+	/* number of steps done so far */
+	int steps;
+	/* highest rate that met the objective, 0 if none */
+	double best;
+	/* lowest rate that failed, 0 if none */
+	double fail;
+};
+
+/* Initialize the search */
+void sweep_init(struct sweep *const sweep, const double min,
+		const double max, const double step);
+
+/* Rate to try in the next step, 0 if the search is done */
+double sweep_next(const struct sweep *const sweep);
+
+/* Record whether the step at rate met the objective */
+void sweep_result(struct sweep *const sweep, const double rate,
+		  const int ok);
+
+#endif /* __LUNA_SWEEP_H__ */
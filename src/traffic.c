@@ -23,29 +23,33 @@
 #include "luna.h"
 #include "traffic.h"
 
-int packet_block_init(struct packet_block *block, int length)
+struct block_ring *block_ring_create(struct packet_block *const first,
+				     const int dynamic)
 {
-	block->lock = malloc(sizeof(pthread_mutex_t));
-	CHKALLOC(block->lock);
-	pthread_mutex_init(block->lock, NULL);
-	block->length = length;
-	block->data = calloc(length, sizeof(struct packet_data));
-	CHKALLOC(block->data);
-	block->next = NULL;
-	return 0;
-}
-
+	struct block_ring *const ring =
+		aligned_alloc(CACHE_LINE_SIZE, sizeof(struct block_ring));
+	CHKALLOC(ring);
 
+	unsigned long count = 0;
+	struct packet_block *block = first;
+	do
+	{
+		count++;
+		block = block->next;
+	} while (block != first);
 
-int packet_block_destroy(struct packet_block *block)
-{
-	int ret = 0;
-	if (pthread_mutex_destroy(block->lock) != 0)
+	/* The sender always holds one block, so with only one block
+	 * in the circle the generator could never refill it. */
+	if (dynamic && count < 2)
 	{
-		fprintf(stderr, "Mutex still locked while trying to free!\n");
-		ret = 1;
+		fprintf(stderr, "ERROR: Generators that refill blocks must "
+			"use at least two blocks!\n");
+		exit(EXIT_INVALID);
 	}
-	free(block->lock);
-	free(block->data);
-	return ret;
+
+	atomic_init(&(ring->filled), count);
+	atomic_init(&(ring->released), 0);
+	ring->count = count;
+	ring->dynamic = dynamic;
+	return ring;
 }
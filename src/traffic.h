@@ -19,9 +19,13 @@
 #ifndef __LUNA_TRAFFIC_H__
 #define __LUNA_TRAFFIC_H__
 
-#include <pthread.h>
+#include <stdatomic.h>
 #include <time.h>
 
+/* Size of a cache line on the platforms we care about. Data written
+ * by different threads is aligned to this to avoid false sharing. */
+#define CACHE_LINE_SIZE 64
+
 /* Contains the information needed to send one packet */
 struct packet_data
 {
@@ -29,15 +33,14 @@ struct packet_data
 	size_t size; /* UDP payload size, including LUNA header */
 };
 
-/* A lockable list of struct packet_data elements, with a pointer to
- * the next block to use */
+/* A list of struct packet_data elements, with a pointer to the next
+ * block to use */
 struct packet_block
 {
-	/* Mutex must be used when separate threads are
-	 * creating/sending data */
-	pthread_mutex_t *lock;
 	/* Length of the list at *data (in struct packet_data
-	 * sizes) */
+	 * sizes). Generators with a finite schedule may shorten
+	 * blocks when refilling them, the sender stops when it
+	 * reaches a block of length 0. */
 	int length;
 	/* Pointer to the list of actual packet data sets */
 	struct packet_data *data;
@@ -45,13 +48,90 @@ struct packet_block
 	struct packet_block *next;
 };
 
-/* Initialize the block. Memory for *block must have been allocated by
- * the caller. This function sets length to the given length,
- * allocates memory for *lock and *data, and initializes the
- * mutex. *next is set to NULL. */
-int packet_block_init(struct packet_block *block, int length);
-/* Free all resources allocated by the block, but not the struct
- * itself. */
-int packet_block_destroy(struct packet_block *block);
+/*
+ * Synchronization of a circle of packet blocks between one generator
+ * (producer) and one sender (consumer), without locks or system
+ * calls. Both sides walk the circle using the next pointers and
+ * count the blocks they have handled:
+ *
+ * filled: number of blocks published by the generator
+ * released: number of blocks the sender is done with
+ *
+ * The sender is working on block number "released" (counted from
+ * the first block of the circle), and may move on if the following
+ * one has been published. The generator may fill the next block if
+ * fewer than "count" blocks are published but not released. The
+ * counters are on separate cache lines because they are written by
+ * different threads.
+ */
+struct block_ring
+{
+	_Alignas(CACHE_LINE_SIZE) atomic_ulong filled;
+	_Alignas(CACHE_LINE_SIZE) atomic_ulong released;
+	/* Number of blocks in the circle */
+	_Alignas(CACHE_LINE_SIZE) unsigned long count;
+	/* If zero, the blocks are never refilled and the sender may
+	 * loop through them without synchronization. */
+	int dynamic;
+};
+
+/* What the sender does if the next block is not ready yet */
+/* wait until the generator has published the block */
+#define UNDERRUN_STALL 0
+/* send the current block again */
+#define UNDERRUN_REPEAT 1
+/* stop sending */
+#define UNDERRUN_ABORT 2
+
+/* Allocate a ring for the circle of blocks starting at first, with
+ * all blocks marked as filled. Free it using free(). */
+struct block_ring *block_ring_create(struct packet_block *const first,
+				     const int dynamic);
+
+/* Generator side: Returns non-zero if the block after the last
+ * published one is free to be filled. */
+static inline int block_ring_writable(struct block_ring *const ring)
+{
+	const unsigned long filled =
+		atomic_load_explicit(&(ring->filled), memory_order_relaxed);
+	const unsigned long released =
+		atomic_load_explicit(&(ring->released), memory_order_acquire);
+	return filled - released < ring->count;
+}
+
+/* Generator side: Publish the block filled after the previous
+ * block_ring_writable() check. */
+static inline void block_ring_publish(struct block_ring *const ring)
+{
+	const unsigned long filled =
+		atomic_load_explicit(&(ring->filled), memory_order_relaxed);
+	atomic_store_explicit(&(ring->filled), filled + 1,
+			      memory_order_release);
+}
+
+/* Number of blocks published but not released yet, including the
+ * one the sender is working on. Only a snapshot if called by the
+ * generator. */
+static inline unsigned long block_ring_ready(struct block_ring *const ring)
+{
+	return atomic_load_explicit(&(ring->filled), memory_order_relaxed)
+		- atomic_load_explicit(&(ring->released),
+				       memory_order_acquire);
+}
+
+/* Sender side: If the block after the current one has been
+ * published, release the current block and return non-zero. Returns
+ * zero without changes otherwise. */
+static inline int block_ring_advance(struct block_ring *const ring)
+{
+	const unsigned long released =
+		atomic_load_explicit(&(ring->released), memory_order_relaxed);
+	if (released + 1 >=
+	    atomic_load_explicit(&(ring->filled), memory_order_acquire))
+		return 0;
+	atomic_store_explicit(&(ring->released), released + 1,
+			      memory_order_release);
+	return 1;
+}
 
 #endif /* __LUNA_TRAFFIC_H__ */
@@ -0,0 +1,299 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <ifaddrs.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "binlog.h"
+#include "luna.h"
+#include "txstamp.h"
+
+/* buffer size for control messages on the error queue, large enough
+ * for a struct scm_timestamping and a struct sock_extended_err with
+ * the attached address */
+#define TXSTAMP_CMSG_BUF 512
+
+void _txstamp_fclose(void *arg);
+
+
+
+/* Find the network interface that has the local address of sock and
+ * store its name in ifname (at least IF_NAMESIZE bytes). Returns 0
+ * on success, -1 if no interface was found. */
+static int socket_interface(const int sock, char *const ifname)
+{
+	struct sockaddr_storage local;
+	socklen_t len = sizeof(local);
+	if (getsockname(sock, (struct sockaddr *) &local, &len) != 0)
+		return -1;
+
+	struct ifaddrs *ifa_list = NULL;
+	if (getifaddrs(&ifa_list) != 0)
+		return -1;
+	int ret = -1;
+	for (struct ifaddrs *ifa = ifa_list; ifa != NULL; ifa = ifa->ifa_next)
+	{
+		if (ifa->ifa_addr == NULL
+		    || ifa->ifa_addr->sa_family != local.ss_family)
+			continue;
+		int match = 0;
+		if (local.ss_family == AF_INET)
+			match = ((struct sockaddr_in *) ifa->ifa_addr)
+				->sin_addr.s_addr ==
+				((struct sockaddr_in *) &local)
+				->sin_addr.s_addr;
+		else if (local.ss_family == AF_INET6)
+			match = memcmp(&(((struct sockaddr_in6 *)
+					  ifa->ifa_addr)->sin6_addr),
+				       &(((struct sockaddr_in6 *)
+					  &local)->sin6_addr),
+				       sizeof(struct in6_addr)) == 0;
+		if (match)
+		{
+			snprintf(ifname, IF_NAMESIZE, "%s", ifa->ifa_name);
+			ret = 0;
+			break;
+		}
+	}
+	freeifaddrs(ifa_list);
+	return ret;
+}
+
+
+
+/* Switch on transmit timestamping in the NIC used by sock, keeping
+ * the receive filter as it is. Returns 0 on success. */
+static int enable_hw_timestamping(const int sock)
+{
+	char ifname[IF_NAMESIZE];
+	if (socket_interface(sock, ifname) != 0)
+	{
+		fprintf(stderr, "Could not find network interface for "
+			"hardware timestamps.\n");
+		return -1;
+	}
+
+	struct hwtstamp_config hwconfig;
+	memset(&hwconfig, 0, sizeof(hwconfig));
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, IF_NAMESIZE, "%s", ifname);
+	ifr.ifr_data = (void *) &hwconfig;
+	/* keep the current receive filter, other applications
+	 * (e.g. PTP daemons) may depend on it */
+	if (ioctl(sock, SIOCGHWTSTAMP, &ifr) != 0)
+		hwconfig.rx_filter = HWTSTAMP_FILTER_NONE;
+	hwconfig.tx_type = HWTSTAMP_TX_ON;
+	if (ioctl(sock, SIOCSHWTSTAMP, &ifr) != 0)
+	{
+		fprintf(stderr, "Could not enable hardware timestamps on "
+			"%s: %s\n", ifname, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+
+
+void enable_tx_timestamps(const int sock, const int mode)
+{
+	/* OPT_ID makes the kernel number the packets sent on the
+	 * socket (starting at 0), OPT_TSONLY avoids copying the packet
+	 * contents to the error queue. */
+	int flags = SOF_TIMESTAMPING_TX_SOFTWARE
+		| SOF_TIMESTAMPING_SOFTWARE
+		| SOF_TIMESTAMPING_OPT_ID
+		| SOF_TIMESTAMPING_OPT_TSONLY;
+	if (mode == TXSTAMP_HARDWARE)
+	{
+		if (enable_hw_timestamping(sock) == 0)
+			flags |= SOF_TIMESTAMPING_TX_HARDWARE
+				| SOF_TIMESTAMPING_RAW_HARDWARE;
+		else
+			fprintf(stderr, "Falling back to software transmit "
+				"timestamps.\n");
+	}
+
+	if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING,
+		       &flags, sizeof(flags)) != 0)
+	{
+		perror("setsockopt SO_TIMESTAMPING");
+		exit(EXIT_NETFAIL);
+	}
+}
+
+
+
+/* Read all timestamps currently queued on the error queue of sock and
+ * write them to out. */
+static void drain_error_queue(const int sock, const int id, FILE *const out,
+			      const int format, char *const cbuf)
+{
+	struct msghdr msg;
+	while (1)
+	{
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = cbuf;
+		msg.msg_controllen = TXSTAMP_CMSG_BUF;
+		if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+		{
+			/* The socket may also signal POLLERR because
+			 * of a pending error (e.g. ICMP port
+			 * unreachable) that does not show up on the
+			 * error queue. Reading SO_ERROR clears it, so
+			 * poll() does not return immediately again. */
+			int err = 0;
+			socklen_t len = sizeof(err);
+			getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len);
+			return;
+		}
+
+		const struct scm_timestamping *tss = NULL;
+		const struct sock_extended_err *serr = NULL;
+		for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+		     cm = CMSG_NXTHDR(&msg, cm))
+		{
+			if (cm->cmsg_level == SOL_SOCKET
+			    && cm->cmsg_type == SCM_TIMESTAMPING)
+				tss = (struct scm_timestamping *)
+					CMSG_DATA(cm);
+			else if ((cm->cmsg_level == SOL_IP
+				  && cm->cmsg_type == IP_RECVERR)
+				 || (cm->cmsg_level == SOL_IPV6
+				     && cm->cmsg_type == IPV6_RECVERR))
+				serr = (struct sock_extended_err *)
+					CMSG_DATA(cm);
+		}
+		if (tss == NULL || serr == NULL
+		    || serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING
+		    || serr->ee_info != SCM_TSTAMP_SND)
+			continue;
+
+		/* hardware timestamp if available, software
+		 * otherwise */
+		const struct timespec *ts = &(tss->ts[2]);
+		char source = 'h';
+		if (ts->tv_sec == 0 && ts->tv_nsec == 0)
+		{
+			ts = &(tss->ts[0]);
+			source = 's';
+		}
+		if (format == LOG_FORMAT_BINARY)
+			binlog_write_packet(out, id, source == 'h' ?
+					    BINLOG_TX_HARDWARE : 0,
+					    ts, 0, serr->ee_data, 0);
+		else
+			fprintf(out, "%ld%06ld.%03ld\t%i\t%u\t%c\n",
+				ts->tv_sec, ts->tv_nsec / NS_PER_US,
+				ts->tv_nsec % NS_PER_US, id, serr->ee_data,
+				source);
+	}
+}
+
+
+
+void *txstamp_thread(void *arg)
+{
+	struct txstamp_thread_data *const data =
+		(struct txstamp_thread_data *) arg;
+
+	/* Collecting timestamps is the least urgent task in the
+	 * client, the kernel queues them until the socket's receive
+	 * buffer is full. Run at the lowest priority of the current
+	 * scheduling policy. */
+	const pthread_t self = pthread_self();
+	int sched_policy = 0;
+	struct sched_param sched_param;
+	pthread_getschedparam(self, &sched_policy, &sched_param);
+	pthread_setschedprio(self, sched_get_priority_min(sched_policy));
+
+	char *const cbuf = malloc(TXSTAMP_CMSG_BUF);
+	CHKALLOC(cbuf);
+	touch_page(cbuf, TXSTAMP_CMSG_BUF);
+	pthread_cleanup_push(&free, cbuf);
+
+	/* poll() reports error queue entries as POLLERR, which does
+	 * not have to be requested */
+	struct pollfd *const fds = calloc(data->nsocks, sizeof(struct pollfd));
+	CHKALLOC(fds);
+	touch_page(fds, data->nsocks * sizeof(struct pollfd));
+	pthread_cleanup_push(&free, fds);
+	for (int i = 0; i < data->nsocks; i++)
+	{
+		fds[i].fd = data->socks[i];
+		fds[i].events = 0;
+	}
+
+	FILE *const out = fopen(data->logfile, "w");
+	if (out == NULL)
+	{
+		perror("Opening transmit timestamp log");
+		exit(EXIT_FILEFAIL);
+	}
+	pthread_cleanup_push(&_txstamp_fclose, out);
+	if (data->format == LOG_FORMAT_BINARY)
+		binlog_write_header(out, BINLOG_TYPE_TXSTAMP, 0);
+	else
+		fprintf(out, "# txtime\tsender\tsequence\tsource\n");
+	sem_post(&(data->sem));
+
+	while (1)
+	{
+		/* poll() is a cancellation point */
+		poll(fds, data->nsocks, -1);
+		for (int i = 0; i < data->nsocks; i++)
+			if (fds[i].revents & POLLERR)
+				drain_error_queue(fds[i].fd, i, out,
+						  data->format, cbuf);
+	}
+
+	/* never reached, see echo_thread() in client.c */
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+
+
+/* fclose() wrapper for pthread_cleanup_push() */
+void _txstamp_fclose(void *arg)
+{
+	if (fclose((FILE *) arg))
+	{
+		perror("Closing transmit timestamp log");
+		exit(EXIT_FILEFAIL);
+	}
+}
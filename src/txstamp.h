@@ -0,0 +1,62 @@
+/*
+ * This file is part of the Lightweight Universal Network Analyzer (LUNA)
+ *
+ * Copyright (c) 2013 Fiona Klute
+ *
+ * LUNA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LUNA is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LUNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LUNA_TXSTAMP_H__
+#define __LUNA_TXSTAMP_H__
+
+#include <semaphore.h>
+
+/* Transmit timestamp modes */
+#define TXSTAMP_NONE 0
+/* timestamps taken by the kernel when passing the packet to the
+ * driver */
+#define TXSTAMP_SOFTWARE 1
+/* timestamps taken by the NIC, falls back to software timestamps
+ * for packets the NIC does not stamp */
+#define TXSTAMP_HARDWARE 2
+
+/* Time to wait for the last timestamps to be reported after sending
+ * is complete (ns) */
+#define TXSTAMP_DRAIN_TIME (100 * 1000 * 1000)
+
+struct txstamp_thread_data
+{
+	/* sockets to read timestamps from, the index is used as
+	 * sender ID in the log */
+	int *socks;
+	int nsocks;
+	/* post to this semaphore when init is done */
+	sem_t sem;
+	/* file to write the log to */
+	const char *logfile;
+	/* LOG_FORMAT_* */
+	int format;
+};
+
+/* Enable transmit timestamps of the given mode (TXSTAMP_*) on the
+ * socket. This must happen before the first packet is sent, so the
+ * IDs the kernel assigns to packets match their sequence numbers.
+ * Exits if the kernel does not support the requested mode. */
+void enable_tx_timestamps(const int sock, const int mode);
+
+/* Thread function to collect transmit timestamps from the error
+ * queues of all sockets in the struct txstamp_thread_data passed as
+ * arg and write them to the log file. Runs until cancelled. */
+void *txstamp_thread(void *arg);
+
+#endif /* __LUNA_TXSTAMP_H__ */